@@ -0,0 +1,300 @@
+//! Criterion benchmarks for every public function, run against the same
+//! kinds of generated corpora as the C benchmarks in c/bench/bench.c.
+//!
+//! Run with `cargo bench` in this directory. Results are reported per pass
+//! over a corpus, along with throughput in bytes of input. For keeping
+//! historical comparisons, Criterion saves machine-readable estimates under
+//! target/criterion, and `cargo bench -- --save-baseline NAME` and
+//! `--baseline NAME` compare against earlier runs.
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion, Throughput};
+use std::ffi::{CStr, CString};
+
+/// xorshift64*, which is plenty for generating test data.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545f4914f6cdd1d)
+    }
+
+    fn range(&mut self, lo: u64, hi: u64) -> u64 {
+        lo + self.next() % (hi - lo + 1)
+    }
+
+    fn char(&mut self, lo: u32, hi: u32) -> char {
+        char::from_u32(self.range(lo.into(), hi.into()) as u32).unwrap()
+    }
+}
+
+fn push_ascii_name(rng: &mut Rng, out: &mut Vec<u8>, len: u64) {
+    const CHARS: &[u8] = b"abcdefghijklmnopqrstuvwxyz0123456789_-.";
+    for _ in 0..len {
+        out.push(CHARS[(rng.next() % CHARS.len() as u64) as usize]);
+    }
+}
+
+fn push_char(out: &mut Vec<u8>, c: char) {
+    out.extend_from_slice(c.encode_utf8(&mut [0; 4]).as_bytes());
+}
+
+fn gen_ascii(rng: &mut Rng, out: &mut Vec<u8>) {
+    for _ in 0..rng.range(3, 8) {
+        out.push(b'/');
+        let len = rng.range(3, 12);
+        push_ascii_name(rng, out, len);
+    }
+}
+
+fn gen_cjk(rng: &mut Rng, out: &mut Vec<u8>) {
+    for _ in 0..rng.range(3, 8) {
+        out.push(b'/');
+        for _ in 0..rng.range(2, 8) {
+            match rng.next() % 8 {
+                0..=4 => push_char(out, rng.char(0x4e00, 0x9fff)),
+                5 => push_char(out, rng.char(0x1f300, 0x1f64f)),
+                _ => push_ascii_name(rng, out, 1),
+            }
+        }
+    }
+}
+
+fn gen_sparse_invalid(rng: &mut Rng, out: &mut Vec<u8>) {
+    gen_ascii(rng, out);
+    let i = rng.range(1, out.len() as u64 - 1) as usize;
+    out[i] = rng.range(0x80, 0xff) as u8;
+}
+
+fn gen_dense_invalid(rng: &mut Rng, out: &mut Vec<u8>) {
+    for _ in 0..rng.range(3, 8) {
+        out.push(b'/');
+        for _ in 0..rng.range(3, 12) {
+            let b = if rng.next() % 2 == 1 {
+                rng.range(0x80, 0xff)
+            } else {
+                rng.range(u64::from(b'a'), u64::from(b'z'))
+            };
+            out.push(b as u8);
+        }
+    }
+}
+
+fn gen_long(rng: &mut Rng, out: &mut Vec<u8>) {
+    while out.len() < 4000 {
+        out.push(b'/');
+        if rng.next() % 16 == 0 {
+            push_char(out, rng.char(0xc0, 0x17f));
+        }
+        let len = rng.range(3, 20);
+        push_ascii_name(rng, out, len);
+    }
+}
+
+/// Paths from a system with Latin-1 file names, where every accented letter
+/// is an invalid byte.
+fn gen_latin1(rng: &mut Rng, out: &mut Vec<u8>) {
+    for _ in 0..rng.range(3, 8) {
+        out.push(b'/');
+        for _ in 0..rng.range(3, 12) {
+            if rng.next() % 6 == 0 {
+                out.push(rng.range(0xc0, 0xff) as u8);
+            } else {
+                push_ascii_name(rng, out, 1);
+            }
+        }
+    }
+}
+
+/// Directory entry names, most of them short and ASCII, some with other
+/// scripts, and a few in legacy 8-bit encodings.
+fn gen_dirnames(rng: &mut Rng, out: &mut Vec<u8>) {
+    let len = rng.range(1, 6) + rng.range(0, 6) * rng.range(0, 3);
+    push_ascii_name(rng, out, len);
+    match rng.next() % 1000 {
+        0..=79 => {
+            push_char(out, rng.char(0xc0, 0x17f));
+            let len = rng.range(0, 6);
+            push_ascii_name(rng, out, len);
+        }
+        80..=99 => {
+            push_char(out, rng.char(0x4e00, 0x9fff));
+            push_char(out, rng.char(0x4e00, 0x9fff));
+        }
+        100..=104 => {
+            out.push(rng.range(0xc0, 0xff) as u8);
+            let len = rng.range(0, 6);
+            push_ascii_name(rng, out, len);
+        }
+        _ => {}
+    }
+}
+
+struct Corpus {
+    name: &'static str,
+    hosts: Vec<CString>,
+    strs: Vec<String>,
+    host_bytes: u64,
+    str_bytes: u64,
+}
+
+fn corpus(name: &'static str, gen: fn(&mut Rng, &mut Vec<u8>)) -> Corpus {
+    let mut rng = Rng(0x9e3779b97f4a7c15);
+    let mut hosts = Vec::new();
+    let mut host_bytes = 0;
+    while host_bytes < 1 << 20 {
+        let mut buf = Vec::new();
+        gen(&mut rng, &mut buf);
+        host_bytes += buf.len() as u64;
+        hosts.push(CString::new(buf).unwrap());
+    }
+    let strs: Vec<String> = hosts.iter().map(|host| host_to_string(host)).collect();
+    let str_bytes = strs.iter().map(|s| s.len() as u64).sum();
+    Corpus {
+        name,
+        hosts,
+        strs,
+        host_bytes,
+        str_bytes,
+    }
+}
+
+#[cfg(not(windows))]
+fn host_to_string(host: &CStr) -> String {
+    arf_strings::host_c_str_to_str(host).into_owned()
+}
+
+/// Windows hosts use WTF-16, which can't hold these byte strings, so use
+/// their lossy forms instead.
+#[cfg(windows)]
+fn host_to_string(host: &CStr) -> String {
+    String::from_utf8_lossy(host.to_bytes()).into_owned()
+}
+
+fn corpora() -> Vec<Corpus> {
+    vec![
+        corpus("ascii", gen_ascii),
+        corpus("cjk", gen_cjk),
+        corpus("sparse-invalid", gen_sparse_invalid),
+        corpus("dense-invalid", gen_dense_invalid),
+        corpus("latin1", gen_latin1),
+        corpus("long", gen_long),
+        corpus("dirnames", gen_dirnames),
+    ]
+}
+
+#[cfg(not(windows))]
+fn benches(c: &mut Criterion) {
+    use std::os::unix::ffi::OsStrExt;
+
+    for corpus in &corpora() {
+        let mut group = c.benchmark_group(corpus.name);
+
+        group.throughput(Throughput::Bytes(corpus.host_bytes));
+        group.bench_function("host_c_str_to_str", |b| {
+            b.iter(|| {
+                for host in &corpus.hosts {
+                    black_box(arf_strings::host_c_str_to_str(black_box(host)));
+                }
+            })
+        });
+        group.bench_function("host_c_str_to_bytes", |b| {
+            b.iter(|| {
+                for host in &corpus.hosts {
+                    black_box(arf_strings::host_c_str_to_bytes(black_box(host)));
+                }
+            })
+        });
+        group.bench_function("host_os_str_to_str", |b| {
+            b.iter(|| {
+                for host in &corpus.hosts {
+                    let os_str = std::ffi::OsStr::from_bytes(host.to_bytes());
+                    black_box(arf_strings::host_os_str_to_str(black_box(os_str)).unwrap());
+                }
+            })
+        });
+        group.bench_function("host_os_str_to_bytes", |b| {
+            b.iter(|| {
+                for host in &corpus.hosts {
+                    let os_str = std::ffi::OsStr::from_bytes(host.to_bytes());
+                    black_box(arf_strings::host_os_str_to_bytes(black_box(os_str)).unwrap());
+                }
+            })
+        });
+
+        group.throughput(Throughput::Bytes(corpus.str_bytes));
+        group.bench_function("str_to_host", |b| {
+            b.iter(|| {
+                for s in &corpus.strs {
+                    black_box(arf_strings::str_to_host(black_box(s)).unwrap());
+                }
+            })
+        });
+        group.bench_function("bytes_to_host", |b| {
+            b.iter(|| {
+                for s in &corpus.strs {
+                    black_box(arf_strings::bytes_to_host(black_box(s.as_bytes())).unwrap());
+                }
+            })
+        });
+        group.bench_function("str_to_host_with", |b| {
+            b.iter(|| {
+                for s in &corpus.strs {
+                    arf_strings::str_to_host_with(black_box(s), |c| Ok(black_box(c).as_ptr()))
+                        .unwrap();
+                }
+            })
+        });
+
+        group.finish();
+    }
+}
+
+#[cfg(windows)]
+fn benches(c: &mut Criterion) {
+    for corpus in &corpora() {
+        let hosts: Vec<std::ffi::OsString> = corpus
+            .strs
+            .iter()
+            .map(|s| arf_strings::str_to_host(s).unwrap())
+            .collect();
+        let mut group = c.benchmark_group(corpus.name);
+
+        group.throughput(Throughput::Bytes(corpus.str_bytes));
+        group.bench_function("str_to_host", |b| {
+            b.iter(|| {
+                for s in &corpus.strs {
+                    black_box(arf_strings::str_to_host(black_box(s)).unwrap());
+                }
+            })
+        });
+        group.bench_function("bytes_to_host", |b| {
+            b.iter(|| {
+                for s in &corpus.strs {
+                    black_box(arf_strings::bytes_to_host(black_box(s.as_bytes())).unwrap());
+                }
+            })
+        });
+        group.bench_function("host_to_str", |b| {
+            b.iter(|| {
+                for host in &hosts {
+                    black_box(arf_strings::host_to_str(black_box(host)).unwrap());
+                }
+            })
+        });
+        group.bench_function("host_to_bytes", |b| {
+            b.iter(|| {
+                for host in &hosts {
+                    black_box(arf_strings::host_to_bytes(black_box(host)).unwrap());
+                }
+            })
+        });
+
+        group.finish();
+    }
+}
+
+criterion_group!(arf, benches);
+criterion_main!(arf);
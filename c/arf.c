@@ -16,232 +16,973 @@ static const uint8_t utf8_replacement[] = { 0xef, 0xbf, 0xbd };
 // The number of bytes in a byte escape sequence.
 static const size_t sizeof_escaped_byte = 2;
 
+// The minimum size of the chunks an `arf_arena` allocates from.
+static const size_t arena_chunk_size = 64 * 1024;
+
+// A chunk of memory in an `arf_arena`, followed by its data.
+struct arf_arena_chunk {
+    struct arf_arena_chunk *prev;
+    uint8_t data[];
+};
+
+#ifdef ARF_STATS
+#include <pthread.h>
+
+// The fields of `struct arf_stats`.
+#define STATS_FIELDS(X)                                                        \
+    X(calls)                                                                   \
+    X(fast_path)                                                               \
+    X(bytes_scanned)                                                           \
+    X(invalid_bytes)                                                           \
+    X(arf_encodes)                                                             \
+    X(arf_decodes)                                                             \
+    X(validation_failures)
+
+// A thread's counters, on a list of all of them so that `arf_stats_get` can
+// add them up. Only the owning thread writes to them.
+struct stats_block {
+    struct arf_stats stats;
+    struct stats_block *prev;
+    struct stats_block *next;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_block *stats_blocks;
+// The totals of threads which have exited.
+static struct arf_stats stats_retired;
+// The totals as of the last `arf_stats_reset`.
+static struct arf_stats stats_baseline;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static __thread struct stats_block *stats_block;
+// Where counts go, unreported, if a thread's counters can't be allocated.
+static __thread struct stats_block stats_fallback;
+
+// Fold an exiting thread's counters into the retired totals.
+static void stats_retire(void *arg) {
+    struct stats_block *block = arg;
+
+    pthread_mutex_lock(&stats_lock);
+#define X(field) stats_retired.field += block->stats.field;
+    STATS_FIELDS(X)
+#undef X
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        stats_blocks = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    pthread_mutex_unlock(&stats_lock);
+
+    stats_block = NULL;
+    free(block);
+}
+
+static void stats_key_init(void) {
+    pthread_key_create(&stats_key, stats_retire);
+}
+
+__attribute__((__noinline__))
+static struct stats_block *stats_register(void) {
+    struct stats_block *block = calloc(1, sizeof(*block));
+    pthread_once(&stats_key_once, stats_key_init);
+    if (block == NULL || pthread_setspecific(stats_key, block) != 0) {
+        free(block);
+        return &stats_fallback;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    block->next = stats_blocks;
+    if (stats_blocks)
+        stats_blocks->prev = block;
+    stats_blocks = block;
+    pthread_mutex_unlock(&stats_lock);
+
+    stats_block = block;
+    return block;
+}
+
+static inline struct arf_stats *thread_stats(void) {
+    struct stats_block *block = stats_block;
+    if (__builtin_expect(block == NULL, false))
+        block = stats_register();
+    return &block->stats;
+}
+
+// Add `n` to the current thread's count of `field`. The store is atomic so
+// that `arf_stats_get` can read it from another thread.
+#define ARF_STAT(field, n)                                                     \
+    do {                                                                       \
+        struct arf_stats *stats_ = thread_stats();                             \
+        __atomic_store_n(&stats_->field, stats_->field + (n),                  \
+                         __ATOMIC_RELAXED);                                    \
+    } while (0)
+
+// Return the totals of every thread's counters.
+static struct arf_stats stats_total(void) {
+    struct arf_stats total = stats_retired;
+    for (struct stats_block *block = stats_blocks; block; block = block->next) {
+#define X(field)                                                               \
+    total.field += __atomic_load_n(&block->stats.field, __ATOMIC_RELAXED);
+        STATS_FIELDS(X)
+#undef X
+    }
+    return total;
+}
+
+ARF_API bool arf_stats_get(struct arf_stats *stats) {
+    pthread_mutex_lock(&stats_lock);
+    struct arf_stats total = stats_total();
+#define X(field) stats->field = total.field - stats_baseline.field;
+    STATS_FIELDS(X)
+#undef X
+    pthread_mutex_unlock(&stats_lock);
+    return true;
+}
+
+ARF_API void arf_stats_reset(void) {
+    pthread_mutex_lock(&stats_lock);
+    stats_baseline = stats_total();
+    pthread_mutex_unlock(&stats_lock);
+}
+#else
+#define ARF_STAT(field, n) ((void)0)
+
+ARF_API bool arf_stats_get(struct arf_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+ARF_API void arf_stats_reset(void) {}
+#endif
+
+// Return the length of the well-formed UTF-8 sequence at `ptr`, or 0 if the
+// byte at `ptr` doesn't begin one.
+static inline size_t utf8_sequence_len(const uint8_t *ptr, const uint8_t *end) {
+    if (ptr[0] < 0x80) {
+        return 1;
+    } else if ((ptr[0] & 0xe0) == 0xc0) {
+        if ((end - ptr) < 2 ||
+            (ptr[0] & 0xfe) == 0xc0 ||
+            (ptr[1] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        return 2;
+    } else if ((ptr[0] & 0xf0) == 0xe0) {
+        if ((end - ptr) < 3 ||
+            (ptr[0] == 0xe0 && (ptr[1] & 0xe0) == 0x80) ||
+            (ptr[0] == 0xed && (ptr[1] & 0xe0) == 0xa0) ||
+            (ptr[0] == 0xef && ptr[1] == 0xbf && (ptr[2] & 0xfe) == 0xbe) ||
+            (ptr[1] & 0xc0) != 0x80 ||
+            (ptr[2] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        return 3;
+    } else if ((ptr[0] & 0xf8) == 0xf0) {
+        if ((end - ptr) < 4 ||
+            ptr[0] > 0xf4 ||
+            (ptr[0] == 0xf0 && (ptr[1] & 0xf0) == 0x80) ||
+            (ptr[0] == 0xf4 && ptr[1] > 0x8f) ||
+            (ptr[1] & 0xc0) != 0x80 ||
+            (ptr[2] & 0xc0) != 0x80 ||
+            (ptr[3] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        return 4;
+    }
+
+    return 0;
+}
+
 // Return a pointer to the first invalid byte, or a pointer to one past the end
-// if the entire string is valid UTF-8.
-static const uint8_t *find_invalid_utf8(const uint8_t *ptr, size_t len) {
+// if the entire string is valid UTF-8. This is the reference implementation;
+// every other kernel below must agree with it exactly.
+static const uint8_t *find_invalid_utf8_scalar(const uint8_t *ptr, size_t len) {
     const uint8_t *end = ptr + len;
     while (ptr != end) {
-        if (ptr[0] < 0x80) {
-            ptr += 1;
-        } else if ((ptr[0] & 0xe0) == 0xc0) {
-            if ((end - ptr) < 2 ||
-                (ptr[0] & 0xfe) == 0xc0 ||
-                (ptr[1] & 0xc0) != 0x80)
-            {
-                break;
+        size_t n = utf8_sequence_len(ptr, end);
+        if (n == 0)
+            break;
+        ptr += n;
+    }
+
+    return ptr;
+}
+
+// Portable kernel: skip ASCII a word at a time, and decode everything else
+// one sequence at a time.
+static const uint8_t *find_invalid_utf8_word(const uint8_t *ptr, size_t len) {
+    const uint8_t *end = ptr + len;
+    while (ptr != end) {
+        if ((size_t)(end - ptr) >= sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, ptr, sizeof(word));
+            if ((word & UINT64_C(0x8080808080808080)) == 0) {
+                ptr += sizeof(word);
+                continue;
             }
-            ptr += 2;
-        } else if ((ptr[0] & 0xf0) == 0xe0) {
-            if ((end - ptr) < 3 ||
-                (ptr[0] == 0xe0 && (ptr[1] & 0xe0) == 0x80) ||
-                (ptr[0] == 0xed && (ptr[1] & 0xe0) == 0xa0) ||
-                (ptr[0] == 0xef && ptr[1] == 0xbf && (ptr[2] & 0xfe) == 0xbe) ||
-                (ptr[1] & 0xc0) != 0x80 ||
-                (ptr[2] & 0xc0) != 0x80)
-            {
-                break;
+        }
+
+        size_t n = utf8_sequence_len(ptr, end);
+        if (n == 0)
+            break;
+        ptr += n;
+    }
+
+    return ptr;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(ARF_NO_SIMD)
+#define ARF_X86_SIMD 1
+#include <immintrin.h>
+
+// The vector kernels below validate whole blocks with the lookup-table
+// algorithm from Keiser and Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte", extended to also reject U+FFFE and U+FFFF. Each block
+// starts on a character boundary, so no state is carried between blocks; a
+// sequence which straddles the end of a block is revalidated as part of the
+// next one. When a block contains an error, the scalar code takes over from
+// the start of the block to find its exact position.
+
+#define UTF8_TOO_SHORT 0x01      // 11______ 0_______ or 11______ 11______
+#define UTF8_TOO_LONG 0x02       // 0_______ 10______
+#define UTF8_OVERLONG_3 0x04     // 11100000 100_____
+#define UTF8_TOO_LARGE 0x08      // 11110100 1001____ and up
+#define UTF8_SURROGATE 0x10      // 11101101 101_____
+#define UTF8_OVERLONG_2 0x20     // 1100000_ 10______
+#define UTF8_TOO_LARGE_1000 0x40 // 11110101 1000____ and up
+#define UTF8_OVERLONG_4 0x40     // 11110000 1000____
+#define UTF8_TWO_CONTS 0x80      // 10______ 10______
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// Error classes indexed by the high nibble of the first byte of a pair.
+static const uint8_t utf8_byte_1_high[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+// Error classes indexed by the low nibble of the first byte of a pair.
+static const uint8_t utf8_byte_1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+// Error classes indexed by the high nibble of the second byte of a pair.
+static const uint8_t utf8_byte_2_high[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// Return the number of bytes at the end of an error-free block which belong
+// to a sequence that continues past the block.
+static inline size_t utf8_incomplete_tail(const uint8_t *block_end) {
+    if (block_end[-1] >= 0xc0)
+        return 1;
+    if (block_end[-2] >= 0xe0)
+        return 2;
+    if (block_end[-3] >= 0xf0)
+        return 3;
+    return 0;
+}
+
+// SSE2 kernel: skip ASCII sixteen bytes at a time. SSE2 has no byte shuffle,
+// so everything else is decoded one sequence at a time.
+__attribute__((__target__("sse2")))
+static const uint8_t *find_invalid_utf8_sse2(const uint8_t *ptr, size_t len) {
+    const uint8_t *end = ptr + len;
+    while (ptr != end) {
+        if ((size_t)(end - ptr) >= sizeof(__m128i)) {
+            __m128i input = _mm_loadu_si128((const __m128i *)ptr);
+            if (_mm_movemask_epi8(input) == 0) {
+                ptr += sizeof(__m128i);
+                continue;
             }
-            ptr += 3;
-        } else if ((ptr[0] & 0xf8) == 0xf0) {
-            if ((end - ptr) < 4 ||
-                ptr[0] > 0xf4 ||
-                (ptr[0] == 0xf0 && (ptr[1] & 0xf0) == 0x80) ||
-                (ptr[0] == 0xf4 && ptr[1] > 0x8f) ||
-                (ptr[1] & 0xc0) != 0x80 ||
-                (ptr[2] & 0xc0) != 0x80 ||
-                (ptr[3] & 0xc0) != 0x80)
+        }
+
+        size_t n = utf8_sequence_len(ptr, end);
+        if (n == 0)
+            break;
+        ptr += n;
+    }
+
+    return ptr;
+}
+
+__attribute__((__target__("ssse3")))
+static inline __m128i utf8_errors_ssse3(__m128i input) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i table_1_high =
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_high);
+    const __m128i table_1_low =
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_low);
+    const __m128i table_2_high =
+        _mm_loadu_si128((const __m128i *)utf8_byte_2_high);
+
+    __m128i prev1 = _mm_slli_si128(input, 1);
+    __m128i prev2 = _mm_slli_si128(input, 2);
+    __m128i prev3 = _mm_slli_si128(input, 3);
+
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(table_1_high,
+                             _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(table_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(table_2_high,
+                         _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+    // The third and fourth bytes of longer sequences must be continuations.
+    __m128i must_be_cont = _mm_and_si128(
+        _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+                     _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80))),
+        _mm_set1_epi8((char)0x80));
+
+    // EF BF BE and EF BF BF encode U+FFFE and U+FFFF.
+    __m128i nonchar = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(prev2, _mm_set1_epi8((char)0xef)),
+                      _mm_cmpeq_epi8(prev1, _mm_set1_epi8((char)0xbf))),
+        _mm_cmpeq_epi8(_mm_or_si128(input, _mm_set1_epi8(1)),
+                       _mm_set1_epi8((char)0xbf)));
+
+    return _mm_or_si128(_mm_xor_si128(must_be_cont, special), nonchar);
+}
+
+__attribute__((__target__("ssse3")))
+static const uint8_t *find_invalid_utf8_ssse3(const uint8_t *ptr, size_t len) {
+    const uint8_t *end = ptr + len;
+    while ((size_t)(end - ptr) >= sizeof(__m128i)) {
+        __m128i input = _mm_loadu_si128((const __m128i *)ptr);
+        if (_mm_movemask_epi8(input) != 0) {
+            __m128i errors = utf8_errors_ssse3(input);
+            if (_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(errors, _mm_setzero_si128())) != 0xffff)
             {
                 break;
             }
-            ptr += 4;
+            ptr += sizeof(__m128i) -
+                   utf8_incomplete_tail(ptr + sizeof(__m128i));
         } else {
-            break;
+            ptr += sizeof(__m128i);
         }
     }
 
-    return ptr;
+    return find_invalid_utf8_scalar(ptr, (size_t)(end - ptr));
+}
+
+// Shift `input` up by `n` bytes across the whole register, shifting in zeros.
+#define UTF8_PREV_AVX2(input, n)                                              \
+    _mm256_alignr_epi8(                                                       \
+        (input),                                                              \
+        _mm256_permute2x128_si256(_mm256_setzero_si256(), (input), 0x21),     \
+        16 - (n))
+
+__attribute__((__target__("avx2")))
+static inline __m256i utf8_errors_avx2(__m256i input) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i table_1_high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_high));
+    const __m256i table_1_low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_low));
+    const __m256i table_2_high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)utf8_byte_2_high));
+
+    __m256i prev1 = UTF8_PREV_AVX2(input, 1);
+    __m256i prev2 = UTF8_PREV_AVX2(input, 2);
+    __m256i prev3 = UTF8_PREV_AVX2(input, 3);
+
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(
+                table_1_high,
+                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(table_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(
+            table_2_high,
+            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+    __m256i must_be_cont = _mm256_and_si256(
+        _mm256_or_si256(
+            _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+            _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80))),
+        _mm256_set1_epi8((char)0x80));
+
+    __m256i nonchar = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(prev2, _mm256_set1_epi8((char)0xef)),
+            _mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xbf))),
+        _mm256_cmpeq_epi8(_mm256_or_si256(input, _mm256_set1_epi8(1)),
+                          _mm256_set1_epi8((char)0xbf)));
+
+    return _mm256_or_si256(_mm256_xor_si256(must_be_cont, special), nonchar);
+}
+
+__attribute__((__target__("avx2")))
+static const uint8_t *find_invalid_utf8_avx2(const uint8_t *ptr, size_t len) {
+    const uint8_t *end = ptr + len;
+    while ((size_t)(end - ptr) >= sizeof(__m256i)) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)ptr);
+        if (_mm256_movemask_epi8(input) != 0) {
+            __m256i errors = utf8_errors_avx2(input);
+            if (!_mm256_testz_si256(errors, errors))
+                break;
+            ptr += sizeof(__m256i) -
+                   utf8_incomplete_tail(ptr + sizeof(__m256i));
+        } else {
+            ptr += sizeof(__m256i);
+        }
+    }
+
+    return find_invalid_utf8_ssse3(ptr, (size_t)(end - ptr));
+}
+
+__attribute__((__target__("avx512f,avx512bw")))
+static inline __m512i utf8_errors_avx512(__m512i input) {
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i table_1_high = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_high));
+    const __m512i table_1_low = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_low));
+    const __m512i table_2_high = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i *)utf8_byte_2_high));
+
+    // Move each 128-bit lane up by one lane, shifting in zeros, so that
+    // per-lane byte alignment can reach across lane boundaries.
+    __m512i lanes = _mm512_maskz_permutexvar_epi64(
+        0xfc, _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0), input);
+    __m512i prev1 = _mm512_alignr_epi8(input, lanes, 16 - 1);
+    __m512i prev2 = _mm512_alignr_epi8(input, lanes, 16 - 2);
+    __m512i prev3 = _mm512_alignr_epi8(input, lanes, 16 - 3);
+
+    __m512i special = _mm512_and_si512(
+        _mm512_and_si512(
+            _mm512_shuffle_epi8(
+                table_1_high,
+                _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble)),
+            _mm512_shuffle_epi8(table_1_low, _mm512_and_si512(prev1, nibble))),
+        _mm512_shuffle_epi8(
+            table_2_high,
+            _mm512_and_si512(_mm512_srli_epi16(input, 4), nibble)));
+
+    __m512i must_be_cont = _mm512_and_si512(
+        _mm512_or_si512(
+            _mm512_subs_epu8(prev2, _mm512_set1_epi8(0xe0 - 0x80)),
+            _mm512_subs_epu8(prev3, _mm512_set1_epi8(0xf0 - 0x80))),
+        _mm512_set1_epi8((char)0x80));
+
+    __mmask64 nonchar =
+        _mm512_cmpeq_epi8_mask(prev2, _mm512_set1_epi8((char)0xef)) &
+        _mm512_cmpeq_epi8_mask(prev1, _mm512_set1_epi8((char)0xbf)) &
+        _mm512_cmpeq_epi8_mask(_mm512_or_si512(input, _mm512_set1_epi8(1)),
+                               _mm512_set1_epi8((char)0xbf));
+
+    return _mm512_mask_mov_epi8(_mm512_xor_si512(must_be_cont, special),
+                                nonchar, _mm512_set1_epi8(-1));
+}
+
+__attribute__((__target__("avx512f,avx512bw")))
+static const uint8_t *find_invalid_utf8_avx512(const uint8_t *ptr,
+                                               size_t len) {
+    const uint8_t *end = ptr + len;
+    while ((size_t)(end - ptr) >= sizeof(__m512i)) {
+        __m512i input = _mm512_loadu_si512((const void *)ptr);
+        if (_mm512_movepi8_mask(input) != 0) {
+            __m512i errors = utf8_errors_avx512(input);
+            if (_mm512_test_epi8_mask(errors, errors) != 0)
+                break;
+            ptr += sizeof(__m512i) -
+                   utf8_incomplete_tail(ptr + sizeof(__m512i));
+        } else {
+            ptr += sizeof(__m512i);
+        }
+    }
+
+    return find_invalid_utf8_avx2(ptr, (size_t)(end - ptr));
+}
+#endif
+
+typedef const uint8_t *(*find_invalid_utf8_fn)(const uint8_t *ptr, size_t len);
+
+// Pick the best kernel for the CPU we're running on.
+static find_invalid_utf8_fn select_find_invalid_utf8(void) {
+#ifdef ARF_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+        return find_invalid_utf8_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return find_invalid_utf8_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return find_invalid_utf8_ssse3;
+    return find_invalid_utf8_sse2;
+#else
+    return find_invalid_utf8_word;
+#endif
+}
+
+static const uint8_t *find_invalid_utf8_first(const uint8_t *ptr, size_t len);
+
+// The selected kernel. This starts out pointing at a trampoline which makes
+// the selection, so that calls made before the constructor below runs (for
+// example, from other constructors) still work.
+static find_invalid_utf8_fn find_invalid_utf8_kernel = find_invalid_utf8_first;
+
+static const uint8_t *find_invalid_utf8_first(const uint8_t *ptr, size_t len) {
+    find_invalid_utf8_fn kernel = select_find_invalid_utf8();
+    __atomic_store_n(&find_invalid_utf8_kernel, kernel, __ATOMIC_RELAXED);
+    return kernel(ptr, len);
 }
 
-bool arf_is_valid_c_str(const char *c_str) {
+__attribute__((__constructor__))
+static void init_find_invalid_utf8(void) {
+    __atomic_store_n(&find_invalid_utf8_kernel, select_find_invalid_utf8(),
+                     __ATOMIC_RELAXED);
+}
+
+ARF_API size_t arf_utf8_valid_up_to_with(enum arf_utf8_kernel kernel,
+                                         const uint8_t *ptr, size_t len) {
+    find_invalid_utf8_fn fn;
+#ifdef ARF_X86_SIMD
+    __builtin_cpu_init();
+#endif
+    switch (kernel) {
+    case ARF_UTF8_KERNEL_AUTO:
+        fn = select_find_invalid_utf8();
+        break;
+    case ARF_UTF8_KERNEL_SCALAR:
+        fn = find_invalid_utf8_scalar;
+        break;
+    case ARF_UTF8_KERNEL_WORD:
+        fn = find_invalid_utf8_word;
+        break;
+#ifdef ARF_X86_SIMD
+    case ARF_UTF8_KERNEL_SSE2:
+        fn = find_invalid_utf8_sse2;
+        break;
+    case ARF_UTF8_KERNEL_SSSE3:
+        if (!__builtin_cpu_supports("ssse3"))
+            return SIZE_MAX;
+        fn = find_invalid_utf8_ssse3;
+        break;
+    case ARF_UTF8_KERNEL_AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return SIZE_MAX;
+        fn = find_invalid_utf8_avx2;
+        break;
+    case ARF_UTF8_KERNEL_AVX512:
+        if (!__builtin_cpu_supports("avx512bw"))
+            return SIZE_MAX;
+        fn = find_invalid_utf8_avx512;
+        break;
+#endif
+    default:
+        return SIZE_MAX;
+    }
+    return (size_t)(fn(ptr, len) - ptr);
+}
+
+// Return a pointer to the first invalid byte, or a pointer to one past the end
+// if the entire string is valid UTF-8.
+static inline const uint8_t *find_invalid_utf8(const uint8_t *ptr, size_t len) {
+    ARF_STAT(bytes_scanned, len);
+    return __atomic_load_n(&find_invalid_utf8_kernel, __ATOMIC_RELAXED)(ptr,
+                                                                        len);
+}
+
+ARF_API bool arf_is_valid_c_str(const char *c_str) {
+    ARF_STAT(calls, 1);
+
     // Check that the C-string is all valid UTF-8.
     size_t c_str_len = strlen(c_str);
     return find_invalid_utf8((const uint8_t *)c_str, c_str_len) ==
            (const uint8_t *)c_str + c_str_len;
 }
 
-bool arf_has_arf_magic(const uint8_t *ptr, size_t len) {
+ARF_API size_t arf_utf8_valid_up_to(const uint8_t *ptr, size_t len) {
+    ARF_STAT(calls, 1);
+    return (size_t)(find_invalid_utf8(ptr, len) - ptr);
+}
+
+ARF_API bool arf_has_arf_magic(const uint8_t *ptr, size_t len) {
     // ARF strings start with a UTF-8 BOM.
     return len >= sizeof(utf8_bom) &&
            memcmp(ptr, utf8_bom, sizeof(utf8_bom)) == 0;
 }
 
-bool arf_is_valid_arf(const uint8_t *ptr, size_t len) {
-    // ARF strings begin and end with fixed bytes.
-    if (!arf_has_arf_magic(ptr, len)) {
-        return false;
-    }
-    ptr += sizeof(utf8_bom);
-    len -= sizeof(utf8_bom);
+#ifdef ARF_X86_SIMD
+// Check that the lossy portion from `lossy` on is valid UTF-8, unless that's
+// already been done. `decode_arf` calls this when it first meets a byte which
+// isn't ASCII.
+static inline bool check_lossy_rest(const uint8_t *lossy,
+                                    const uint8_t *lossy_end, bool *checked) {
+    if (*checked)
+        return true;
+    *checked = true;
+    return find_invalid_utf8(lossy, (size_t)(lossy_end - lossy)) == lossy_end;
+}
+#endif
 
-    // ARF strings are valid UTF-8.
-    if (find_invalid_utf8(ptr, len) != ptr + len) {
-        return false;
-    }
+/// Validate the ARF string in the `len` bytes at `ptr`, whose separator NUL
+/// is at `nul`, and write the C-string it encodes into `out` as far as it fits
+/// within `cap` bytes. On success, or if the C-string doesn't fit, store its
+/// size including the terminating NUL in *size.
+///
+/// Output is only ever written to bytes which have already been read and
+/// aren't needed again, so `out` may be `ptr` itself.
+static enum arf_status decode_arf(const uint8_t *ptr, size_t len,
+                                  const uint8_t *nul, uint8_t *out, size_t cap,
+                                  size_t *size) {
+    const uint8_t *end = ptr + len;
 
-    // ARF strings contain a NUL byte separating the replacement portion from
-    // the NUL-escaped portion.
-    size_t first_len = strlen((const char *)ptr);
-    if (first_len >= len) {
-        return false;
-    }
+    // ARF strings begin with fixed bytes.
+    if (!arf_has_arf_magic(ptr, len))
+        return ARF_INVALID;
 
-    // Check that the lossy portion translates to the NUL-escaped portion.
+    // ARF strings are valid UTF-8. Given the correspondence checked below,
+    // it's sufficient to check the lossy portion. With SIMD, the sweep below
+    // checks it from the first byte which isn't ASCII or part of a
+    // replacement character, if any; everything before that is valid, and
+    // hasn't been overwritten yet when decoding in place.
+    const uint8_t *lossy = ptr + sizeof(utf8_bom);
+    const uint8_t *lossy_end = nul;
+#ifdef ARF_X86_SIMD
+    bool utf8_checked = false;
+#else
+    if (find_invalid_utf8(lossy, (size_t)(lossy_end - lossy)) != lossy_end)
+        return ARF_INVALID;
+#endif
+
+    // Check that the lossy portion translates to the NUL-escaped portion,
+    // decoding the NUL-escaped portion as we go.
+    const uint8_t *escaped = nul + 1;
     bool any_invalid_bytes = false;
-    size_t second_begin = first_len + 1;
-    size_t i = 0, j = second_begin;
-    while (i != first_len) {
-        if (ptr[j] == 0) {
-            // Check the NUL-escaped encoding.
-            if (len - j < sizeof_escaped_byte || (int8_t)ptr[j + 1] < 0) {
-                return false;
-            }
+    size_t c_str_len = 0;
+    while (lossy != lossy_end) {
+        const uint8_t *escape;
+        size_t run;
 
-            // Check that the escaped string contains a replacement character.
-            if (first_len - i < sizeof(utf8_replacement) ||
-                memcmp(ptr + i, utf8_replacement,
-                       sizeof(utf8_replacement)) != 0)
+#ifdef ARF_X86_SIMD
+        // Compare a block of each portion. Where they first differ, if
+        // anywhere, must be the next escape. Bytes which match aren't NUL,
+        // because the lossy portion has none. Decoded bytes are written
+        // behind both portions, so a block is only stored once it's been
+        // read in full.
+        if (end - escaped >= 16 && lossy_end - lossy >= 16) {
+            __m128i l = _mm_loadu_si128((const __m128i *)lossy);
+            __m128i e = _mm_loadu_si128((const __m128i *)escaped);
+            unsigned mismatch =
+                (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(l, e)) ^ 0xffff;
+            unsigned high = (unsigned)_mm_movemask_epi8(l);
+            if (mismatch == 0) {
+                if (high && !check_lossy_rest(lossy, lossy_end, &utf8_checked))
+                    return ARF_INVALID;
+                if (c_str_len < cap && cap - c_str_len >= 16)
+                    _mm_storeu_si128((__m128i *)(out + c_str_len), e);
+                c_str_len += 16;
+                lossy += 16;
+                escaped += 16;
+                continue;
+            }
+            run = (size_t)__builtin_ctz(mismatch);
+            if ((high & ((1u << run) - 1)) &&
+                !check_lossy_rest(lossy, lossy_end, &utf8_checked))
             {
-                return false;
+                return ARF_INVALID;
             }
-
-            i += sizeof(utf8_replacement);
-            j += sizeof_escaped_byte;
-            any_invalid_bytes = true;
-        } else {
-            // Check that the bytes match.
-            if (ptr[i] != ptr[j]) {
-                return false;
+            if (escaped[run] != '\0')
+                return ARF_INVALID;
+            escape = escaped + run;
+        } else
+#endif
+        {
+            // Find the next escape, looking no further than the lossy
+            // portion could match, and check that the bytes before it match.
+            size_t avail = (size_t)(end - escaped);
+            if (avail > (size_t)(lossy_end - lossy))
+                avail = (size_t)(lossy_end - lossy);
+            escape = memchr(escaped, '\0', avail);
+            run = escape ? (size_t)(escape - escaped) : avail;
+            if (memcmp(lossy, escaped, run) != 0)
+                return ARF_INVALID;
+#ifdef ARF_X86_SIMD
+            for (size_t i = 0; i != run; ++i) {
+                if ((int8_t)lossy[i] < 0 &&
+                    !check_lossy_rest(lossy, lossy_end, &utf8_checked))
+                {
+                    return ARF_INVALID;
+                }
             }
+#endif
+        }
 
-            i += 1;
-            j += 1;
+        // Copy out the bytes before it.
+        if (c_str_len < cap && cap - c_str_len >= run)
+            memcpy(out + c_str_len, escaped, run);
+        c_str_len += run;
+        lossy += run;
+        escaped += run;
+
+        if (!escape)
+            break;
+
+        // Check the NUL-escaped encoding.
+        if ((size_t)(end - escaped) < sizeof_escaped_byte ||
+            (int8_t)escaped[1] < 0)
+        {
+            return ARF_INVALID;
+        }
+
+        // Check that the lossy portion contains a replacement character.
+        if ((size_t)(lossy_end - lossy) < sizeof(utf8_replacement) ||
+            memcmp(lossy, utf8_replacement, sizeof(utf8_replacement)) != 0)
+        {
+            return ARF_INVALID;
         }
+
+        if (c_str_len < cap)
+            out[c_str_len] = escaped[1] | (uint8_t)INT8_MIN;
+        c_str_len += 1;
+        lossy += sizeof(utf8_replacement);
+        escaped += sizeof_escaped_byte;
+        any_invalid_bytes = true;
     }
 
-    // If there weren't any invalid bytes, we shouldn't have an ARF string.
-    if (!any_invalid_bytes) {
+    // Both portions must end together. If there weren't any invalid bytes,
+    // we shouldn't have an ARF string.
+    if (lossy != lossy_end || escaped != end || !any_invalid_bytes)
+        return ARF_INVALID;
+
+    // Arf! Append the terminating NUL.
+    *size = c_str_len + 1;
+    if (c_str_len >= cap)
+        return ARF_TOO_SMALL;
+    out[c_str_len] = '\0';
+    return ARF_OK;
+}
+
+ARF_API bool arf_is_valid_arf(const uint8_t *ptr, size_t len) {
+    // ARF strings contain a NUL byte separating the replacement portion from
+    // the NUL-escaped portion.
+    ARF_STAT(calls, 1);
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    if (nul == NULL) {
+        ARF_STAT(validation_failures, 1);
         return false;
     }
 
-    // Arf!
+    size_t size;
+    if (decode_arf(ptr, len, nul, NULL, 0, &size) == ARF_INVALID) {
+        ARF_STAT(validation_failures, 1);
+        return false;
+    }
     return true;
 }
 
-/// Like `arf_sizeof_c_str_arf`, but has `strlen(c_str)` passed in so that it
-/// doesn't need to be recomputed.
-static size_t arf_sizeof_c_str_arf_impl(const char *c_str, size_t c_str_len) {
-    // Start with the length of the fixed-length parts of an ARF string.
-    size_t len = sizeof(utf8_bom) + 1;
-
-    // Add the size of both the lossy portion and the NUL-escaped portion.
-    for (size_t i = 0; i != c_str_len; ) {
-        const uint8_t *found =
-            find_invalid_utf8((const uint8_t *)c_str + i, c_str_len - i);
+/// Compute the ARF string for the `len` bytes at `in`, where `invalid` points
+/// to the first invalid byte (or to the end), and write it into `out` if it
+/// fits within `cap` bytes. Return its length, or `SIZE_MAX` on overflow.
+///
+/// The input is validated in a single forward sweep. During the sweep, the
+/// NUL-escaped portion is written just after the BOM, since its contents
+/// don't depend on anything we haven't seen yet. Once the sweep knows how long
+/// the lossy portion is, the NUL-escaped portion is moved into its final
+/// position and the lossy portion is derived from it, without looking at the
+/// input again.
+static size_t encode_arf(const uint8_t *in, size_t len, const uint8_t *invalid,
+                         uint8_t *out, size_t cap) {
+    const uint8_t *end = in + len;
+    size_t pos = sizeof(utf8_bom);
+    size_t invalid_bytes = 0;
 
+    for (;;) {
         // Copy in valid UTF-8 bytes.
-        size_t valid_len = (size_t)(found - ((const uint8_t *)c_str + i));
-        if (__builtin_add_overflow(len, valid_len * 2, &len))
-            return SIZE_MAX;
+        size_t valid_len = (size_t)(invalid - in);
+        if (pos <= cap && cap - pos >= valid_len)
+            memcpy(out + pos, in, valid_len);
+        pos += valid_len;
 
-        i += valid_len;
-        if (i == c_str_len)
+        if (invalid == end)
             break;
 
-        // Handle an invalid byte.
-        size_t more = sizeof(utf8_replacement) + sizeof_escaped_byte;
-        if (__builtin_add_overflow(len, more, &len))
-            return SIZE_MAX;
+        // Emit a NUL-escaped byte.
+        if (pos <= cap && cap - pos >= sizeof_escaped_byte) {
+            out[pos] = '\0';
+            out[pos + 1] = *invalid & INT8_MAX;
+        }
+        pos += sizeof_escaped_byte;
+        invalid_bytes += 1;
 
-        i += 1;
+        in = invalid + 1;
+        invalid = find_invalid_utf8(in, (size_t)(end - in));
     }
 
-    return len;
+    ARF_STAT(arf_encodes, 1);
+    ARF_STAT(invalid_bytes, invalid_bytes);
+
+    // Each escape sequence in the NUL-escaped portion corresponds to a
+    // replacement character, which is one byte longer, in the lossy portion.
+    size_t escaped_len = pos - sizeof(utf8_bom);
+    size_t lossy_len = escaped_len + invalid_bytes;
+    size_t total;
+    if (__builtin_add_overflow(lossy_len, escaped_len, &total) ||
+        __builtin_add_overflow(total, sizeof(utf8_bom) + 1, &total))
+    {
+        return SIZE_MAX;
+    }
+    if (total > cap)
+        return total;
+
+    // Everything fit, so move the NUL-escaped portion to the end.
+    uint8_t *escaped = out + total - escaped_len;
+    memmove(escaped, out + sizeof(utf8_bom), escaped_len);
+
+    memcpy(out, utf8_bom, sizeof(utf8_bom));
+
+    // Derive the lossy portion from the NUL-escaped portion.
+    uint8_t *lossy = out + sizeof(utf8_bom);
+    const uint8_t *escaped_end = out + total;
+    while (escaped != escaped_end) {
+        const uint8_t *nul =
+            memchr(escaped, '\0', (size_t)(escaped_end - escaped));
+        size_t run = (size_t)((nul ? nul : escaped_end) - escaped);
+        memcpy(lossy, escaped, run);
+        lossy += run;
+        escaped += run;
+
+        if (!nul)
+            break;
+
+        memcpy(lossy, utf8_replacement, sizeof(utf8_replacement));
+        lossy += sizeof(utf8_replacement);
+        escaped += sizeof_escaped_byte;
+    }
+
+    *lossy = '\0';
+
+    return total;
 }
 
-bool arf_categorize_c_str(const char *c_str, size_t *restrict len) {
+ARF_API bool arf_categorize_c_str(const char *c_str, size_t *restrict len) {
+    const uint8_t *in = (const uint8_t *)c_str;
     size_t c_str_len = strlen(c_str);
+    const uint8_t *invalid = find_invalid_utf8(in, c_str_len);
+    ARF_STAT(calls, 1);
 
-    if (__builtin_expect(find_invalid_utf8((const uint8_t *)c_str, c_str_len) ==
-                         (const uint8_t *)c_str + c_str_len,
-                         true))
-    {
+    if (__builtin_expect(invalid == in + c_str_len, true)) {
+        ARF_STAT(fast_path, 1);
         *len = c_str_len;
         return true;
     }
 
-    *len = arf_sizeof_c_str_arf_impl(c_str, c_str_len);
+    *len = encode_arf(in, c_str_len, invalid, NULL, 0);
     return false;
 }
 
-size_t arf_sizeof_c_str_arf(const char *c_str) {
-    return arf_sizeof_c_str_arf_impl(c_str, strlen(c_str));
+ARF_API size_t arf_sizeof_c_str_arf(const char *c_str) {
+    ARF_STAT(calls, 1);
+    const uint8_t *in = (const uint8_t *)c_str;
+    size_t c_str_len = strlen(c_str);
+    return encode_arf(in, c_str_len, find_invalid_utf8(in, c_str_len), NULL,
+                      0);
 }
 
-void arf_c_str_arf(const char *c_str, uint8_t *ptr) {
+ARF_API void arf_c_str_arf(const char *c_str, uint8_t *ptr) {
+    ARF_STAT(calls, 1);
+    const uint8_t *in = (const uint8_t *)c_str;
     size_t c_str_len = strlen(c_str);
+    encode_arf(in, c_str_len, find_invalid_utf8(in, c_str_len), ptr,
+               SIZE_MAX);
+}
 
-    memcpy(ptr, utf8_bom, sizeof(utf8_bom));
-    ptr += sizeof(utf8_bom);
-
-    // Encode the replacement-encoded portion.
-    const uint8_t *in = (const uint8_t*)c_str;
-    for (size_t len = c_str_len; len != 0; ) {
-        const uint8_t *invalid = find_invalid_utf8(in, len);
+ARF_API size_t arf_encode(const uint8_t *in, size_t len, uint8_t *out,
+                          size_t cap) {
+    const uint8_t *invalid = find_invalid_utf8(in, len);
+    ARF_STAT(calls, 1);
 
-        // Copy in valid UTF-8 bytes.
-        size_t valid_len = (size_t)(invalid - in);
-        memcpy(ptr, in, valid_len);
-        ptr += valid_len;
-        in += valid_len;
-        len -= valid_len;
+    if (__builtin_expect(invalid == in + len, true)) {
+        ARF_STAT(fast_path, 1);
+        if (len <= cap && len != 0)
+            memcpy(out, in, len);
+        return len;
+    }
 
-        if (len == 0)
-            break;
+    return encode_arf(in, len, invalid, out, cap);
+}
 
-        // Handle an invalid byte.
-        memcpy(ptr, utf8_replacement, sizeof(utf8_replacement));
-        ptr += sizeof(utf8_replacement);
-        in += 1;
-        len -= 1;
-    }
+ARF_API size_t arf_sizeof_c_strs_arf(const char *const *c_strs, size_t *count) {
+    size_t n = 0;
+    size_t size = 0;
 
-    *ptr++ = '\0';
+    for (; c_strs[n] != NULL; ++n) {
+        const uint8_t *in = (const uint8_t *)c_strs[n];
+        size_t c_str_len = strlen(c_strs[n]);
+        const uint8_t *invalid = find_invalid_utf8(in, c_str_len);
+        ARF_STAT(calls, 1);
 
-    // Encode the full-encoded portion.
-    in = (const uint8_t*)c_str;
-    for (size_t len = c_str_len; len != 0; ) {
-        const uint8_t *invalid = find_invalid_utf8(in, len);
+        // Valid UTF-8 is passed through; only invalid strings are sized as
+        // ARF strings. Either way, add one for the terminating NUL.
+        size_t len;
+        if (__builtin_expect(invalid == in + c_str_len, true)) {
+            ARF_STAT(fast_path, 1);
+            len = c_str_len;
+        } else {
+            len = encode_arf(in, c_str_len, invalid, NULL, 0);
+        }
+        if (__builtin_add_overflow(size, len, &size) ||
+            __builtin_add_overflow(size, 1, &size))
+        {
+            return SIZE_MAX;
+        }
+    }
 
-        // Copy in valid UTF-8 bytes.
-        size_t valid_len = (size_t)(invalid - in);
-        memcpy(ptr, in, valid_len);
-        ptr += valid_len;
-        in += valid_len;
-        len -= valid_len;
+    *count = n;
+    return size;
+}
 
-        if (len == 0)
-            break;
+ARF_API void arf_c_strs_arf(const char *const *c_strs, uint8_t *buf,
+                            size_t *offsets) {
+    size_t pos = 0;
 
-        // Emit a NUL-escaped byte.
-        *ptr++ = '\0';
-        *ptr++ = *in & INT8_MAX;
-        in += 1;
-        len -= 1;
+    for (size_t n = 0; c_strs[n] != NULL; ++n) {
+        offsets[n] = pos;
+        pos += arf_encode((const uint8_t *)c_strs[n], strlen(c_strs[n]),
+                          buf + pos, SIZE_MAX);
+        buf[pos++] = '\0';
     }
 }
 
-size_t arf_sizeof_arf_c_str(const uint8_t *ptr, size_t len) {
+ARF_API size_t arf_sizeof_arf_c_str(const uint8_t *ptr, size_t len) {
     assert(arf_is_valid_arf(ptr, len));
+    ARF_STAT(calls, 1);
 
     const uint8_t *end = ptr + len;
 
@@ -262,8 +1003,11 @@ size_t arf_sizeof_arf_c_str(const uint8_t *ptr, size_t len) {
     return c_str_len;
 }
 
-void arf_arf_c_str(const uint8_t *ptr, size_t len, char *__restrict__ c_str) {
+ARF_API void arf_arf_c_str(const uint8_t *ptr, size_t len,
+                           char *__restrict__ c_str) {
     assert(arf_is_valid_arf(ptr, len));
+    ARF_STAT(calls, 1);
+    ARF_STAT(arf_decodes, 1);
 
     const uint8_t *end = ptr + len;
 
@@ -282,3 +1026,1562 @@ void arf_arf_c_str(const uint8_t *ptr, size_t len, char *__restrict__ c_str) {
     // Append the terminating NUL.
     *c_str = '\0';
 }
+
+ARF_API enum arf_status arf_decode(const uint8_t *ptr, size_t len,
+                                   char *__restrict__ c_str, size_t cap,
+                                   size_t *__restrict__ size) {
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    ARF_STAT(calls, 1);
+
+    // Strings containing NUL bytes must be ARF strings.
+    if (__builtin_expect(nul != NULL, false)) {
+        enum arf_status status =
+            decode_arf(ptr, len, nul, (uint8_t *)c_str, cap, size);
+        if (status == ARF_INVALID)
+            ARF_STAT(validation_failures, 1);
+        else
+            ARF_STAT(arf_decodes, 1);
+        return status;
+    }
+
+    // Everything else must be valid UTF-8, which we pass through as-is.
+    if (find_invalid_utf8(ptr, len) != ptr + len) {
+        ARF_STAT(validation_failures, 1);
+        return ARF_INVALID;
+    }
+    ARF_STAT(fast_path, 1);
+
+    *size = len + 1;
+    if (len >= cap)
+        return ARF_TOO_SMALL;
+    memcpy(c_str, ptr, len);
+    c_str[len] = '\0';
+    return ARF_OK;
+}
+
+// Decode the NUL-escaped portion from `p` to `end`, which must be valid, into
+// `out`, copying the runs between escapes. Return the end of the output.
+static uint8_t *copy_escaped(const uint8_t *p, const uint8_t *end,
+                             uint8_t *out) {
+    for (;;) {
+        const uint8_t *escape = memchr(p, '\0', (size_t)(end - p));
+        const uint8_t *run_end = escape ? escape : end;
+        memcpy(out, p, (size_t)(run_end - p));
+        out += run_end - p;
+        if (escape == NULL)
+            return out;
+        *out++ = escape[1] | (uint8_t)INT8_MIN;
+        p = escape + sizeof_escaped_byte;
+    }
+}
+
+ARF_API size_t arf_decode_trusted(const uint8_t *ptr, size_t len, char *c_str) {
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    const uint8_t *end = ptr + len;
+    uint8_t *out = (uint8_t *)c_str;
+
+#ifdef ARF_CHECK_TRUSTED
+    size_t checked_size;
+    if (arf_decode(ptr, len, NULL, 0, &checked_size) != ARF_TOO_SMALL)
+        abort();
+#endif
+
+    ARF_STAT(calls, 1);
+    if (__builtin_expect(nul != NULL, false)) {
+        ARF_STAT(arf_decodes, 1);
+
+        // Skip the lossy portion, and decode the NUL-escaped portion.
+        out = copy_escaped(nul + 1, end, out);
+    } else {
+        ARF_STAT(fast_path, 1);
+        memcpy(out, ptr, len);
+        out += len;
+    }
+    *out++ = '\0';
+
+    size_t size = (size_t)(out - (uint8_t *)c_str);
+#ifdef ARF_CHECK_TRUSTED
+    if (size != checked_size)
+        abort();
+#endif
+    return size;
+}
+
+ARF_API enum arf_status arf_decode_in_place(uint8_t *buf, size_t len,
+                                            size_t cap, size_t *size) {
+    assert(len <= cap);
+    const uint8_t *nul = memchr(buf, '\0', len);
+    ARF_STAT(calls, 1);
+
+    // `decode_arf` writes each decoded byte at least a BOM's length behind
+    // the lossy byte it was checked against, and reads nothing behind that,
+    // so it can decode over its own input.
+    if (__builtin_expect(nul != NULL, false)) {
+        enum arf_status status = decode_arf(buf, len, nul, buf, cap, size);
+        if (status == ARF_INVALID)
+            ARF_STAT(validation_failures, 1);
+        else
+            ARF_STAT(arf_decodes, 1);
+        return status;
+    }
+
+    // Plain UTF-8 is already in place, and just needs its NUL.
+    if (find_invalid_utf8(buf, len) != buf + len) {
+        ARF_STAT(validation_failures, 1);
+        return ARF_INVALID;
+    }
+    ARF_STAT(fast_path, 1);
+    *size = len + 1;
+    if (len >= cap)
+        return ARF_TOO_SMALL;
+    buf[len] = '\0';
+    return ARF_OK;
+}
+
+ARF_API void arf_arena_init(struct arf_arena *arena) {
+    arena->chunk = NULL;
+    arena->next = NULL;
+    arena->end = NULL;
+}
+
+ARF_API void arf_arena_reset(struct arf_arena *arena) {
+    struct arf_arena_chunk *chunk = arena->chunk;
+    if (chunk == NULL)
+        return;
+
+    // Keep the current chunk, and free the ones before it.
+    for (struct arf_arena_chunk *prev = chunk->prev; prev != NULL; ) {
+        struct arf_arena_chunk *next = prev->prev;
+        free(prev);
+        prev = next;
+    }
+
+    chunk->prev = NULL;
+    arena->next = chunk->data;
+}
+
+ARF_API void arf_arena_destroy(struct arf_arena *arena) {
+    for (struct arf_arena_chunk *chunk = arena->chunk; chunk != NULL; ) {
+        struct arf_arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    arf_arena_init(arena);
+}
+
+/// Make sure there are at least `size` bytes available at `arena->next`,
+/// starting a new chunk if needed.
+static bool arena_reserve(struct arf_arena *arena, size_t size) {
+    if ((size_t)(arena->end - arena->next) >= size)
+        return true;
+
+    size_t chunk_size = size > arena_chunk_size ? size : arena_chunk_size;
+    if (chunk_size > SIZE_MAX - sizeof(struct arf_arena_chunk))
+        return false;
+
+    struct arf_arena_chunk *chunk =
+        malloc(sizeof(struct arf_arena_chunk) + chunk_size);
+    if (chunk == NULL)
+        return false;
+
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->next = chunk->data;
+    arena->end = chunk->data + chunk_size;
+    return true;
+}
+
+ARF_API enum arf_status arf_encode_in(struct arf_arena *arena,
+                                      const uint8_t *in, size_t len,
+                                      const uint8_t **out, size_t *out_len) {
+    const uint8_t *invalid = find_invalid_utf8(in, len);
+    ARF_STAT(calls, 1);
+
+    // Valid UTF-8 is its own encoding.
+    if (__builtin_expect(invalid == in + len, true)) {
+        ARF_STAT(fast_path, 1);
+        *out = in;
+        *out_len = len;
+        return ARF_OK;
+    }
+
+    // Try encoding into the space left in the current chunk, and if it
+    // doesn't fit, start a new chunk that's big enough.
+    size_t size = encode_arf(in, len, invalid, arena->next,
+                             (size_t)(arena->end - arena->next));
+    if (size > (size_t)(arena->end - arena->next)) {
+        if (size == SIZE_MAX || !arena_reserve(arena, size))
+            return ARF_NO_MEMORY;
+        encode_arf(in, len, invalid, arena->next, size);
+    }
+
+    *out = arena->next;
+    *out_len = size;
+    arena->next += size;
+    return ARF_OK;
+}
+
+ARF_API enum arf_status arf_decode_in(struct arf_arena *arena,
+                                      const uint8_t *ptr, size_t len,
+                                      const char **c_str, size_t *size) {
+    // A decoded string is never longer than its input plus a NUL.
+    if (len == SIZE_MAX || !arena_reserve(arena, len + 1))
+        return ARF_NO_MEMORY;
+
+    enum arf_status status =
+        arf_decode(ptr, len, (char *)arena->next, len + 1, size);
+    if (status != ARF_OK)
+        return status;
+
+    *c_str = (const char *)arena->next;
+    arena->next += *size;
+    return ARF_OK;
+}
+
+/// Append `len` bytes to a growable buffer, returning false if memory
+/// allocation fails.
+static bool spool(uint8_t **buf, size_t *buf_len, size_t *buf_cap,
+                  const uint8_t *ptr, size_t len) {
+    if (len == 0)
+        return true;
+
+    if (*buf_cap - *buf_len < len) {
+        size_t cap = *buf_cap < 64 ? 64 : *buf_cap;
+        while (cap - *buf_len < len) {
+            if (__builtin_mul_overflow(cap, 2, &cap))
+                return false;
+        }
+
+        uint8_t *new_buf = realloc(*buf, cap);
+        if (new_buf == NULL)
+            return false;
+        *buf = new_buf;
+        *buf_cap = cap;
+    }
+
+    memcpy(*buf + *buf_len, ptr, len);
+    *buf_len += len;
+    return true;
+}
+
+/// Return the length of the sequence a byte would start if it's a leading
+/// byte, or 0 if it can't start a multi-byte sequence.
+static size_t utf8_lead_len(uint8_t b) {
+    if ((b & 0xe0) == 0xc0)
+        return 2;
+    if ((b & 0xf0) == 0xe0)
+        return 3;
+    if ((b & 0xf8) == 0xf0)
+        return 4;
+    return 0;
+}
+
+/// Encode the valid UTF-8 bytes at `ptr`.
+static bool encoder_valid(struct arf_encoder *enc, const uint8_t *ptr,
+                          size_t len, uint8_t **out) {
+    memcpy(*out, ptr, len);
+    *out += len;
+    return spool(&enc->escaped, &enc->escaped_len, &enc->escaped_cap, ptr,
+                 len);
+}
+
+/// Encode an invalid byte.
+static bool encoder_invalid(struct arf_encoder *enc, uint8_t b,
+                            uint8_t **out) {
+    const uint8_t escape[] = { '\0', b & INT8_MAX };
+
+    memcpy(*out, utf8_replacement, sizeof(utf8_replacement));
+    *out += sizeof(utf8_replacement);
+    return spool(&enc->escaped, &enc->escaped_len, &enc->escaped_cap, escape,
+                 sizeof(escape));
+}
+
+/// Encode the `len` bytes at `in`. If `more` is true, more input may follow,
+/// so a sequence which is cut off at the end is carried over rather than
+/// treated as invalid.
+static bool encoder_run(struct arf_encoder *enc, const uint8_t *in,
+                        size_t len, bool more, uint8_t **out) {
+    const uint8_t *end = in + len;
+    while (in != end) {
+        const uint8_t *invalid = find_invalid_utf8(in, (size_t)(end - in));
+        if (!encoder_valid(enc, in, (size_t)(invalid - in), out))
+            return false;
+        if (invalid == end)
+            break;
+
+        if (more && utf8_lead_len(*invalid) > (size_t)(end - invalid)) {
+            enc->pending_len = (uint8_t)(end - invalid);
+            memcpy(enc->pending, invalid, enc->pending_len);
+            break;
+        }
+
+        if (!encoder_invalid(enc, *invalid, out))
+            return false;
+        in = invalid + 1;
+    }
+
+    return true;
+}
+
+ARF_API void arf_encoder_init(struct arf_encoder *enc) {
+    enc->escaped = NULL;
+    enc->escaped_len = 0;
+    enc->escaped_cap = 0;
+    enc->pending_len = 0;
+    enc->started = false;
+}
+
+ARF_API size_t arf_encoder_update(struct arf_encoder *enc, const uint8_t *in,
+                                  size_t len, uint8_t *out) {
+    uint8_t *start = out;
+
+    if (!enc->started) {
+        memcpy(out, utf8_bom, sizeof(utf8_bom));
+        out += sizeof(utf8_bom);
+        enc->started = true;
+    }
+
+    // Finish off any bytes carried over from the previous chunk, using just
+    // enough new input to complete any sequence they start.
+    if (enc->pending_len != 0) {
+        uint8_t tmp[sizeof(enc->pending) + 3];
+        size_t carried = enc->pending_len;
+        size_t taken = len < 3 ? len : 3;
+        memcpy(tmp, enc->pending, carried);
+        memcpy(tmp + carried, in, taken);
+        enc->pending_len = 0;
+
+        size_t i = 0;
+        while (i < carried) {
+            size_t n = utf8_sequence_len(tmp + i, tmp + carried + taken);
+            if (n != 0) {
+                if (!encoder_valid(enc, tmp + i, n, &out))
+                    return SIZE_MAX;
+                i += n;
+            } else if (taken == len &&
+                       utf8_lead_len(tmp[i]) > carried + taken - i) {
+                // Still not enough input to tell; carry it all over again.
+                enc->pending_len = (uint8_t)(carried + taken - i);
+                memcpy(enc->pending, tmp + i, enc->pending_len);
+                return (size_t)(out - start);
+            } else {
+                if (!encoder_invalid(enc, tmp[i], &out))
+                    return SIZE_MAX;
+                i += 1;
+            }
+        }
+
+        in += i - carried;
+        len -= i - carried;
+    }
+
+    if (!encoder_run(enc, in, len, true, &out))
+        return SIZE_MAX;
+
+    return (size_t)(out - start);
+}
+
+ARF_API size_t arf_sizeof_encoder_finish(const struct arf_encoder *enc) {
+    // Carried-over bytes are encoded as if they were a whole string.
+    size_t pending_arf =
+        encode_arf(enc->pending, enc->pending_len,
+                   find_invalid_utf8(enc->pending, enc->pending_len), NULL, 0);
+
+    return (enc->started ? 0 : sizeof(utf8_bom)) +
+           (pending_arf - sizeof(utf8_bom)) + enc->escaped_len;
+}
+
+ARF_API size_t arf_encoder_finish(struct arf_encoder *enc, uint8_t *out) {
+    uint8_t *start = out;
+
+    if (!enc->started) {
+        memcpy(out, utf8_bom, sizeof(utf8_bom));
+        out += sizeof(utf8_bom);
+        enc->started = true;
+    }
+
+    // There's no more input, so carried-over bytes are whatever they are.
+    size_t pending_len = enc->pending_len;
+    enc->pending_len = 0;
+    if (!encoder_run(enc, enc->pending, pending_len, false, &out))
+        return SIZE_MAX;
+
+    *out++ = '\0';
+
+    if (enc->escaped_len != 0) {
+        memcpy(out, enc->escaped, enc->escaped_len);
+        out += enc->escaped_len;
+    }
+
+    return (size_t)(out - start);
+}
+
+ARF_API void arf_encoder_destroy(struct arf_encoder *enc) {
+    free(enc->escaped);
+    arf_encoder_init(enc);
+}
+
+// States of an `arf_decoder`.
+enum {
+    DECODER_BOM,
+    DECODER_LOSSY,
+    DECODER_ESCAPED,
+    DECODER_ESCAPE,
+    DECODER_INVALID,
+    DECODER_NO_MEMORY,
+};
+
+ARF_API void arf_decoder_init(struct arf_decoder *dec) {
+    dec->lossy = NULL;
+    dec->lossy_len = 0;
+    dec->lossy_cap = 0;
+    dec->matched = 0;
+    dec->state = DECODER_BOM;
+    dec->bom_len = 0;
+    dec->any_invalid_bytes = false;
+}
+
+ARF_API size_t arf_decoder_update(struct arf_decoder *dec, const uint8_t *in,
+                                  size_t len, char *out) {
+    const uint8_t *end = in + len;
+    char *start = out;
+
+    while (in != end) {
+        switch (dec->state) {
+        case DECODER_BOM:
+            // ARF strings begin with fixed bytes.
+            if (*in++ != utf8_bom[dec->bom_len++]) {
+                dec->state = DECODER_INVALID;
+                return SIZE_MAX;
+            }
+            if (dec->bom_len == sizeof(utf8_bom))
+                dec->state = DECODER_LOSSY;
+            break;
+
+        case DECODER_LOSSY: {
+            // Hold on to the lossy portion, up to the separator NUL.
+            const uint8_t *nul = memchr(in, '\0', (size_t)(end - in));
+            const uint8_t *run_end = nul ? nul : end;
+            if (!spool(&dec->lossy, &dec->lossy_len, &dec->lossy_cap, in,
+                       (size_t)(run_end - in)))
+            {
+                dec->state = DECODER_NO_MEMORY;
+                return SIZE_MAX;
+            }
+            in = run_end;
+
+            if (nul) {
+                // ARF strings are valid UTF-8. As in `decode_arf`, it's
+                // sufficient to check the lossy portion. It can't be empty,
+                // since it has a U+FFFD for each escape, and there's at least
+                // one, and checking that here also means it's been allocated.
+                if (dec->lossy_len == 0 ||
+                    find_invalid_utf8(dec->lossy, dec->lossy_len) !=
+                        dec->lossy + dec->lossy_len)
+                {
+                    dec->state = DECODER_INVALID;
+                    return SIZE_MAX;
+                }
+                in += 1;
+                dec->state = DECODER_ESCAPED;
+            }
+            break;
+        }
+
+        case DECODER_ESCAPED: {
+            // Check that the bytes up to the next escape match the lossy
+            // portion, and copy them out.
+            size_t avail = (size_t)(end - in);
+            size_t remaining = dec->lossy_len - dec->matched;
+            const uint8_t *escape = memchr(in, '\0', avail);
+            size_t run = escape ? (size_t)(escape - in) : avail;
+            if (run > remaining ||
+                memcmp(dec->lossy + dec->matched, in, run) != 0)
+            {
+                dec->state = DECODER_INVALID;
+                return SIZE_MAX;
+            }
+            memcpy(out, in, run);
+            out += run;
+            in += run;
+            dec->matched += run;
+
+            if (escape) {
+                in += 1;
+                dec->state = DECODER_ESCAPE;
+            }
+            break;
+        }
+
+        case DECODER_ESCAPE: {
+            // Check the NUL-escaped encoding against a replacement character
+            // in the lossy portion.
+            uint8_t b = *in++;
+            if ((int8_t)b < 0 ||
+                dec->lossy_len - dec->matched < sizeof(utf8_replacement) ||
+                memcmp(dec->lossy + dec->matched, utf8_replacement,
+                       sizeof(utf8_replacement)) != 0)
+            {
+                dec->state = DECODER_INVALID;
+                return SIZE_MAX;
+            }
+            *out++ = (char)(b | (uint8_t)INT8_MIN);
+            dec->matched += sizeof(utf8_replacement);
+            dec->any_invalid_bytes = true;
+            dec->state = DECODER_ESCAPED;
+            break;
+        }
+
+        default:
+            return SIZE_MAX;
+        }
+    }
+
+    return (size_t)(out - start);
+}
+
+ARF_API enum arf_status arf_decoder_finish(struct arf_decoder *dec, char *out) {
+    if (dec->state == DECODER_NO_MEMORY)
+        return ARF_NO_MEMORY;
+
+    // Both portions must end together, and there must have been at least
+    // one invalid byte.
+    if (dec->state != DECODER_ESCAPED || dec->matched != dec->lossy_len ||
+        !dec->any_invalid_bytes)
+    {
+        return ARF_INVALID;
+    }
+
+    *out = '\0';
+    return ARF_OK;
+}
+
+ARF_API void arf_decoder_destroy(struct arf_decoder *dec) {
+    free(dec->lossy);
+    arf_decoder_init(dec);
+}
+
+// The Windows scheme. Hosts use UTF-16 which may contain unpaired
+// surrogates, and the NUL-escaped portion escapes each one as the offset of
+// its code unit from U+D800, a code point between U+0 and U+7FF.
+
+// Return a pointer to the first unpaired surrogate, or a pointer to one past
+// the end if there are none.
+static const uint16_t *find_unpaired_surrogate(const uint16_t *ptr,
+                                               size_t len) {
+    const uint16_t *end = ptr + len;
+
+#ifdef ARF_X86_SIMD
+    // Skip blocks without any surrogates, which is nearly all of them, and
+    // pick through the rest one unit at a time.
+    const __m128i surrogate_mask = _mm_set1_epi16((short)0xf800);
+    const __m128i surrogate = _mm_set1_epi16((short)0xd800);
+    while (end - ptr >= 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i s = _mm_cmpeq_epi16(_mm_and_si128(v, surrogate_mask), surrogate);
+        if (_mm_movemask_epi8(s) == 0) {
+            ptr += 8;
+            continue;
+        }
+
+        const uint16_t *block_end = ptr + 8;
+        while (ptr < block_end) {
+            if ((*ptr & 0xf800) != 0xd800) {
+                ptr += 1;
+            } else if (*ptr < 0xdc00 && end - ptr >= 2 &&
+                       (ptr[1] & 0xfc00) == 0xdc00)
+            {
+                ptr += 2;
+            } else {
+                return ptr;
+            }
+        }
+    }
+#endif
+
+    while (ptr != end) {
+        if ((*ptr & 0xf800) != 0xd800) {
+            ptr += 1;
+        } else if (*ptr < 0xdc00 && end - ptr >= 2 &&
+                   (ptr[1] & 0xfc00) == 0xdc00)
+        {
+            ptr += 2;
+        } else {
+            return ptr;
+        }
+    }
+    return ptr;
+}
+
+// Write the UTF-8 encoding of `c` to `out`, if it's non-NULL and there's room
+// before `cap`, and return its length.
+static size_t put_utf8(uint8_t *out, size_t pos, size_t cap, uint32_t c) {
+    uint8_t buf[4];
+    size_t n;
+
+    if (c < 0x80) {
+        buf[0] = (uint8_t)c;
+        n = 1;
+    } else if (c < 0x800) {
+        buf[0] = (uint8_t)(0xc0 | (c >> 6));
+        buf[1] = (uint8_t)(0x80 | (c & 0x3f));
+        n = 2;
+    } else if (c < 0x10000) {
+        buf[0] = (uint8_t)(0xe0 | (c >> 12));
+        buf[1] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+        buf[2] = (uint8_t)(0x80 | (c & 0x3f));
+        n = 3;
+    } else {
+        buf[0] = (uint8_t)(0xf0 | (c >> 18));
+        buf[1] = (uint8_t)(0x80 | ((c >> 12) & 0x3f));
+        buf[2] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+        buf[3] = (uint8_t)(0x80 | (c & 0x3f));
+        n = 4;
+    }
+
+    if (out && pos <= cap && cap - pos >= n)
+        memcpy(out + pos, buf, n);
+    return n;
+}
+
+// How `utf16_to_utf8` treats unpaired surrogates.
+enum utf16_portion {
+    // As U+FFFD, for the lossy portion.
+    UTF16_LOSSY,
+    // As escapes, for the NUL-escaped portion.
+    UTF16_ESCAPED,
+};
+
+// Transcode the `len` units at `in` to UTF-8, writing into `out` at `pos`
+// where it fits within `cap`, and return the number of bytes produced.
+static size_t utf16_to_utf8(const uint16_t *in, size_t len, uint8_t *out,
+                            size_t pos, size_t cap,
+                            enum utf16_portion portion) {
+    const uint16_t *end = in + len;
+    size_t start = pos;
+
+    while (in != end) {
+#ifdef ARF_X86_SIMD
+        // Narrow runs of ASCII eight units at a time.
+        if (end - in >= 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)in);
+            __m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xff80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) ==
+                0xffff)
+            {
+                if (out && pos <= cap && cap - pos >= 8)
+                    _mm_storel_epi64((__m128i *)(out + pos),
+                                     _mm_packus_epi16(v, v));
+                in += 8;
+                pos += 8;
+                continue;
+            }
+        }
+#endif
+
+        uint32_t c = *in++;
+        if ((c & 0xf800) == 0xd800) {
+            if (c < 0xdc00 && in != end && (*in & 0xfc00) == 0xdc00) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (*in++ - 0xdc00u);
+            } else if (portion == UTF16_LOSSY) {
+                c = 0xfffd;
+            } else {
+                pos += put_utf8(out, pos, cap, 0);
+                c -= 0xd800;
+            }
+        }
+        pos += put_utf8(out, pos, cap, c);
+    }
+
+    return pos - start;
+}
+
+ARF_API size_t arf_encode_utf16(const uint16_t *in, size_t len, uint8_t *out,
+                                size_t cap) {
+    const uint16_t *unpaired = find_unpaired_surrogate(in, len);
+    ARF_STAT(calls, 1);
+    ARF_STAT(bytes_scanned, len * sizeof(*in));
+
+    // Valid UTF-16 is transcoded as-is. Each unit produces at most three
+    // bytes, so when there's room for that we can skip the sizing pass.
+    if (__builtin_expect(unpaired == in + len, true)) {
+        ARF_STAT(fast_path, 1);
+        if (len <= cap / 3)
+            return utf16_to_utf8(in, len, out, 0, cap, UTF16_LOSSY);
+        size_t size = utf16_to_utf8(in, len, NULL, 0, 0, UTF16_LOSSY);
+        if (size <= cap)
+            utf16_to_utf8(in, len, out, 0, cap, UTF16_LOSSY);
+        return size;
+    }
+
+    ARF_STAT(arf_encodes, 1);
+    size_t lossy = utf16_to_utf8(in, len, NULL, 0, 0, UTF16_LOSSY);
+    size_t escaped = utf16_to_utf8(in, len, NULL, 0, 0, UTF16_ESCAPED);
+    size_t total;
+    if (__builtin_add_overflow(sizeof(utf8_bom) + 1, lossy, &total) ||
+        __builtin_add_overflow(total, escaped, &total))
+    {
+        return SIZE_MAX;
+    }
+
+    if (total <= cap) {
+        memcpy(out, utf8_bom, sizeof(utf8_bom));
+        size_t pos = sizeof(utf8_bom);
+        pos += utf16_to_utf8(in, len, out, pos, cap, UTF16_LOSSY);
+        out[pos++] = '\0';
+        utf16_to_utf8(in, len, out, pos, cap, UTF16_ESCAPED);
+    }
+    return total;
+}
+
+// Decode the UTF-8 sequence at *ptr, advancing past it, and return its code
+// point, or -1 if it's invalid. Unlike `utf8_sequence_len`, this follows
+// plain UTF-8, which allows noncharacters, as the Windows scheme does.
+static int32_t utf8_decode(const uint8_t **ptr, const uint8_t *end) {
+    const uint8_t *p = *ptr;
+    uint32_t c = p[0];
+    size_t n;
+    uint32_t min;
+
+    if (c < 0x80) {
+        *ptr = p + 1;
+        return (int32_t)c;
+    } else if ((c & 0xe0) == 0xc0) {
+        n = 2;
+        min = 0x80;
+        c &= 0x1f;
+    } else if ((c & 0xf0) == 0xe0) {
+        n = 3;
+        min = 0x800;
+        c &= 0x0f;
+    } else if ((c & 0xf8) == 0xf0) {
+        n = 4;
+        min = 0x10000;
+        c &= 0x07;
+    } else {
+        return -1;
+    }
+
+    if ((size_t)(end - p) < n)
+        return -1;
+    for (size_t i = 1; i != n; ++i) {
+        if ((p[i] & 0xc0) != 0x80)
+            return -1;
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+    if (c < min || c > 0x10ffff || (c & 0xfffff800) == 0xd800)
+        return -1;
+
+    *ptr = p + n;
+    return (int32_t)c;
+}
+
+// Append the UTF-16 encoding of `c` to `out` at *pos where it fits within
+// `cap`.
+static void put_utf16(uint16_t *out, size_t *pos, size_t cap, uint32_t c) {
+    if (c < 0x10000) {
+        if (*pos < cap)
+            out[*pos] = (uint16_t)c;
+        *pos += 1;
+    } else {
+        c -= 0x10000;
+        if (*pos < cap && cap - *pos >= 2) {
+            out[*pos] = (uint16_t)(0xd800 + (c >> 10));
+            out[*pos + 1] = (uint16_t)(0xdc00 + (c & 0x3ff));
+        }
+        *pos += 2;
+    }
+}
+
+static enum arf_status decode_utf16(const uint8_t *ptr, size_t len,
+                                    const uint8_t *nul,
+                                    uint16_t *__restrict__ out, size_t cap,
+                                    size_t *__restrict__ size) {
+    const uint8_t *end = ptr + len;
+    size_t pos = 0;
+
+    if (__builtin_expect(nul == NULL, true)) {
+        // Plain UTF-8, which we transcode as-is.
+        while (ptr != end) {
+            int32_t c = utf8_decode(&ptr, end);
+            if (c < 0)
+                return ARF_INVALID;
+            put_utf16(out, &pos, cap, (uint32_t)c);
+        }
+    } else {
+        // ARF strings begin with fixed bytes.
+        if (!arf_has_arf_magic(ptr, len))
+            return ARF_INVALID;
+
+        // Check that the lossy portion translates to the NUL-escaped
+        // portion, a code point at a time, decoding as we go.
+        const uint8_t *lossy = ptr + sizeof(utf8_bom);
+        const uint8_t *escaped = nul + 1;
+        bool any_invalid_bytes = false;
+        while (escaped != end) {
+            int32_t c = utf8_decode(&escaped, end);
+            if (c < 0 || lossy == nul)
+                return ARF_INVALID;
+            int32_t l = utf8_decode(&lossy, nul);
+
+            if (c == 0) {
+                // An escaped unpaired surrogate, in place of a U+FFFD.
+                if (escaped == end)
+                    return ARF_INVALID;
+                c = utf8_decode(&escaped, end);
+                if (c < 0 || c > 0x7ff || l != 0xfffd)
+                    return ARF_INVALID;
+                if (pos < cap)
+                    out[pos] = (uint16_t)(0xd800 + c);
+                pos += 1;
+                any_invalid_bytes = true;
+            } else {
+                if (l != c)
+                    return ARF_INVALID;
+                put_utf16(out, &pos, cap, (uint32_t)c);
+            }
+        }
+
+        // Both portions must end together. If there weren't any invalid
+        // units, we shouldn't have an ARF string.
+        if (lossy != nul || !any_invalid_bytes)
+            return ARF_INVALID;
+    }
+
+    // Append the terminating NUL.
+    *size = pos + 1;
+    if (pos >= cap)
+        return ARF_TOO_SMALL;
+    out[pos] = 0;
+    return ARF_OK;
+}
+
+ARF_API enum arf_status arf_decode_utf16(const uint8_t *ptr, size_t len,
+                                         uint16_t *__restrict__ out, size_t cap,
+                                         size_t *__restrict__ size) {
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    enum arf_status status = decode_utf16(ptr, len, nul, out, cap, size);
+
+    ARF_STAT(calls, 1);
+    ARF_STAT(bytes_scanned, len);
+    if (status == ARF_INVALID)
+        ARF_STAT(validation_failures, 1);
+    else if (nul != NULL)
+        ARF_STAT(arf_decodes, 1);
+    else
+        ARF_STAT(fast_path, 1);
+    return status;
+}
+
+// Paths. These work on the lossy and NUL-escaped portions of an ARF string
+// directly. Slashes are ASCII, so they appear as themselves in both portions,
+// and the nth slash in one corresponds to the nth slash in the other, except
+// that in the NUL-escaped portion an escaped byte may also be a slash.
+
+// Write the `len` bytes of host data at `in`, whose first invalid byte is at
+// `invalid`, into `out` at `pos` where it fits within `cap`, with invalid
+// bytes replaced by escapes if `escaped` is true and by U+FFFD otherwise.
+// Return the number of bytes produced.
+static size_t put_portion(const uint8_t *in, size_t len,
+                          const uint8_t *invalid, bool escaped, uint8_t *out,
+                          size_t pos, size_t cap) {
+    const uint8_t *end = in + len;
+    size_t start = pos;
+
+    for (;;) {
+        size_t valid_len = (size_t)(invalid - in);
+        if (pos <= cap && cap - pos >= valid_len && valid_len != 0)
+            memcpy(out + pos, in, valid_len);
+        pos += valid_len;
+
+        if (invalid == end)
+            break;
+
+        if (escaped) {
+            if (pos <= cap && cap - pos >= sizeof_escaped_byte) {
+                out[pos] = '\0';
+                out[pos + 1] = *invalid & INT8_MAX;
+            }
+            pos += sizeof_escaped_byte;
+        } else {
+            if (pos <= cap && cap - pos >= sizeof(utf8_replacement))
+                memcpy(out + pos, utf8_replacement, sizeof(utf8_replacement));
+            pos += sizeof(utf8_replacement);
+        }
+
+        in = invalid + 1;
+        invalid = find_invalid_utf8(in, (size_t)(end - in));
+    }
+
+    return pos - start;
+}
+
+ARF_API size_t arf_path_join(const uint8_t *base, size_t base_len,
+                             const uint8_t *name, size_t name_len, uint8_t *out,
+                             size_t cap) {
+    const uint8_t *invalid = find_invalid_utf8(name, name_len);
+    bool name_valid = invalid == name + name_len;
+    const uint8_t *nul = memchr(base, '\0', base_len);
+
+    // A base with a NUL in it had better be an ARF string, or there's no
+    // lossy portion to find.
+    if (nul != NULL && !arf_has_arf_magic(base, base_len))
+        return SIZE_MAX;
+
+    // The lossy portion of the base, or the whole base if it's plain UTF-8,
+    // and the NUL-escaped portion, which is empty if it's plain.
+    size_t lossy_len = nul ? (size_t)(nul - base) - sizeof(utf8_bom) : base_len;
+    const uint8_t *lossy = nul ? base + sizeof(utf8_bom) : base;
+    size_t escaped_len = nul ? base_len - (size_t)(nul + 1 - base) : 0;
+    size_t sep = lossy_len != 0 && lossy[lossy_len - 1] != '/';
+
+    // A plain base and a valid name make a plain path.
+    if (nul == NULL && name_valid) {
+        size_t total;
+        if (__builtin_add_overflow(base_len + sep, name_len, &total))
+            return SIZE_MAX;
+        if (total <= cap) {
+            if (out != base && base_len != 0)
+                memmove(out, base, base_len);
+            if (sep)
+                out[base_len] = '/';
+            if (name_len != 0)
+                memcpy(out + base_len + sep, name, name_len);
+        }
+        return total;
+    }
+
+    // Otherwise it's an ARF string. If the base is plain, it forms the start
+    // of both portions.
+    size_t name_lossy_len =
+        put_portion(name, name_len, invalid, false, NULL, 0, 0);
+    size_t name_escaped_len =
+        put_portion(name, name_len, invalid, true, NULL, 0, 0);
+    if (nul == NULL)
+        escaped_len = base_len;
+    size_t escaped_start, total;
+    if (__builtin_add_overflow(sizeof(utf8_bom) + lossy_len + 1 + sep,
+                               name_lossy_len, &escaped_start) ||
+        __builtin_add_overflow(escaped_start, escaped_len + sep, &total) ||
+        __builtin_add_overflow(total, name_escaped_len, &total))
+    {
+        return SIZE_MAX;
+    }
+    if (total > cap)
+        return total;
+
+    // Move the base's portions into place, last first, so that `out` may be
+    // `base`.
+    const uint8_t *escaped = nul ? nul + 1 : base;
+    memmove(out + escaped_start, escaped, escaped_len);
+    memmove(out + sizeof(utf8_bom), lossy, lossy_len);
+    memcpy(out, utf8_bom, sizeof(utf8_bom));
+
+    size_t pos = sizeof(utf8_bom) + lossy_len;
+    if (sep)
+        out[pos++] = '/';
+    pos += put_portion(name, name_len, invalid, false, out, pos, cap);
+    out[pos++] = '\0';
+
+    pos += escaped_len;
+    if (sep)
+        out[pos++] = '/';
+    put_portion(name, name_len, invalid, true, out, pos, cap);
+
+    return total;
+}
+
+// Return the offset of the `n`th slash, counting from one, in the
+// NUL-escaped portion at `escaped`, or `len` if there are fewer.
+static size_t escaped_slash(const uint8_t *escaped, size_t len, size_t n) {
+    for (size_t i = 0; i != len; ++i) {
+        if (escaped[i] == '\0')
+            i += 1;
+        else if (escaped[i] == '/' && --n == 0)
+            return i;
+    }
+    return len;
+}
+
+// Count the slashes in the `len` bytes at `ptr`.
+static size_t count_slashes(const uint8_t *ptr, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i != len; ++i)
+        n += ptr[i] == '/';
+    return n;
+}
+
+// Write the `len` bytes at `ptr` to `out`, if they fit within `cap`, and
+// return `len`. They may overlap.
+static size_t put_bytes(const uint8_t *ptr, size_t len, uint8_t *out,
+                        size_t cap) {
+    if (len <= cap && len != 0)
+        memmove(out, ptr, len);
+    return len;
+}
+
+// Test whether the `len` bytes of a lossy portion at `ptr` contain U+FFFD.
+static bool has_replacement(const uint8_t *ptr, size_t len) {
+    const uint8_t *end = ptr + len;
+    while ((ptr = memchr(ptr, utf8_replacement[0], (size_t)(end - ptr)))) {
+        if (end - ptr >= 3 && ptr[1] == utf8_replacement[1] &&
+            ptr[2] == utf8_replacement[2])
+        {
+            return true;
+        }
+        ptr += 1;
+    }
+    return false;
+}
+
+// Write the part of `path` which corresponds to the range from `begin` to
+// `end` of its lossy portion, or of the whole of it if it's plain UTF-8,
+// which begins just after a slash, or at the start, and ends just before a
+// slash, or at the end.
+static size_t put_path_range(const uint8_t *path, size_t len,
+                             const uint8_t *nul, size_t begin, size_t end,
+                             uint8_t *out, size_t cap) {
+    const uint8_t *lossy = nul ? path + sizeof(utf8_bom) : path;
+
+    // Without any U+FFFD, the range is the same in both portions, and plain.
+    if (nul == NULL || !has_replacement(lossy + begin, end - begin))
+        return put_bytes(lossy + begin, end - begin, out, cap);
+
+    // Find the same range in the NUL-escaped portion. Where there's no
+    // U+FFFD after the range, it ends the same distance from the end.
+    size_t lossy_len = (size_t)(nul - lossy);
+    const uint8_t *escaped = nul + 1;
+    size_t escaped_len = len - (size_t)(escaped - path);
+    size_t n = count_slashes(lossy, begin);
+    size_t escaped_begin =
+        n == 0 ? 0 : escaped_slash(escaped, escaped_len, n) + 1;
+    size_t escaped_end;
+    if (!has_replacement(lossy + end, lossy_len - end)) {
+        escaped_end = escaped_len - (lossy_len - end);
+    } else {
+        n = count_slashes(lossy + begin, end - begin) + 1;
+        escaped_end = escaped_begin + escaped_slash(escaped + escaped_begin,
+                                                    escaped_len - escaped_begin,
+                                                    n);
+    }
+
+    // The U+FFFD may have been literal, leaving no escapes.
+    size_t range_len = escaped_end - escaped_begin;
+    if (memchr(escaped + escaped_begin, '\0', range_len) == NULL)
+        return put_bytes(escaped + escaped_begin, range_len, out, cap);
+
+    size_t total = sizeof(utf8_bom) + (end - begin) + 1 + range_len;
+    if (total <= cap) {
+        // Everything moves towards the start, so `out` may be `path`.
+        memmove(out + sizeof(utf8_bom), lossy + begin, end - begin);
+        memcpy(out, utf8_bom, sizeof(utf8_bom));
+        out[sizeof(utf8_bom) + (end - begin)] = '\0';
+        memmove(out + total - range_len, escaped + escaped_begin, range_len);
+    }
+    return total;
+}
+
+ARF_API size_t arf_path_parent(const uint8_t *path, size_t len, uint8_t *out,
+                               size_t cap) {
+    const uint8_t *nul = memchr(path, '\0', len);
+    const uint8_t *lossy = nul ? path + sizeof(utf8_bom) : path;
+    size_t lossy_len = nul ? (size_t)(nul - lossy) : len;
+
+    // Strip trailing slashes, then the last component, then the slashes
+    // before it.
+    size_t end = lossy_len;
+    while (end != 0 && lossy[end - 1] == '/')
+        end -= 1;
+    if (end == 0)
+        return put_bytes((const uint8_t *)(lossy_len ? "/" : "."), 1, out, cap);
+    while (end != 0 && lossy[end - 1] != '/')
+        end -= 1;
+    if (end == 0)
+        return put_bytes((const uint8_t *)".", 1, out, cap);
+    while (end != 0 && lossy[end - 1] == '/')
+        end -= 1;
+    if (end == 0)
+        return put_bytes((const uint8_t *)"/", 1, out, cap);
+
+    return put_path_range(path, len, nul, 0, end, out, cap);
+}
+
+ARF_API size_t arf_path_basename(const uint8_t *path, size_t len, uint8_t *out,
+                                 size_t cap) {
+    const uint8_t *nul = memchr(path, '\0', len);
+    const uint8_t *lossy = nul ? path + sizeof(utf8_bom) : path;
+    size_t lossy_len = nul ? (size_t)(nul - lossy) : len;
+
+    // Strip trailing slashes, then everything before the last component.
+    size_t end = lossy_len;
+    while (end != 0 && lossy[end - 1] == '/')
+        end -= 1;
+    if (end == 0)
+        return put_bytes((const uint8_t *)(lossy_len ? "/" : "."), 1, out, cap);
+    size_t begin = end;
+    while (begin != 0 && lossy[begin - 1] != '/')
+        begin -= 1;
+
+    return put_path_range(path, len, nul, begin, end, out, cap);
+}
+
+// Hashing and comparison in terms of host bytes. The hash is XXH64, which
+// reads eight bytes at a time into four independent lanes.
+
+static const uint64_t xxh_prime1 = 0x9e3779b185ebca87;
+static const uint64_t xxh_prime2 = 0xc2b2ae3d27d4eb4f;
+static const uint64_t xxh_prime3 = 0x165667b19e3779f9;
+static const uint64_t xxh_prime4 = 0x85ebca77c2b2ae63;
+static const uint64_t xxh_prime5 = 0x27d4eb2f165667c5;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read_le64(const uint8_t *ptr) {
+    uint64_t x;
+    memcpy(&x, ptr, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+static inline uint32_t read_le32(const uint8_t *ptr) {
+    uint32_t x;
+    memcpy(&x, ptr, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap32(x);
+#endif
+    return x;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * xxh_prime2;
+    acc = rotl64(acc, 31);
+    return acc * xxh_prime1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xxh_round(0, lane);
+    return acc * xxh_prime1 + xxh_prime4;
+}
+
+// Process as many whole 32-byte stripes of `ptr` as there are, and return
+// the number of bytes consumed.
+static size_t xxh_stripes(uint64_t acc[4], const uint8_t *ptr, size_t len) {
+    const uint8_t *start = ptr;
+    uint64_t a0 = acc[0], a1 = acc[1], a2 = acc[2], a3 = acc[3];
+    while (len >= 32) {
+        a0 = xxh_round(a0, read_le64(ptr));
+        a1 = xxh_round(a1, read_le64(ptr + 8));
+        a2 = xxh_round(a2, read_le64(ptr + 16));
+        a3 = xxh_round(a3, read_le64(ptr + 24));
+        ptr += 32;
+        len -= 32;
+    }
+    acc[0] = a0;
+    acc[1] = a1;
+    acc[2] = a2;
+    acc[3] = a3;
+    return (size_t)(ptr - start);
+}
+
+ARF_API void arf_hasher_init(struct arf_hasher *hasher, uint64_t seed) {
+    hasher->acc[0] = seed + xxh_prime1 + xxh_prime2;
+    hasher->acc[1] = seed + xxh_prime2;
+    hasher->acc[2] = seed;
+    hasher->acc[3] = seed - xxh_prime1;
+    hasher->seed = seed;
+    hasher->total_len = 0;
+    hasher->buf_len = 0;
+}
+
+ARF_API void arf_hasher_update(struct arf_hasher *hasher, const uint8_t *ptr,
+                               size_t len) {
+    hasher->total_len += len;
+
+    // Top up a partial stripe first.
+    if (hasher->buf_len != 0) {
+        size_t n = sizeof(hasher->buf) - hasher->buf_len;
+        if (n > len)
+            n = len;
+        if (n != 0)
+            memcpy(hasher->buf + hasher->buf_len, ptr, n);
+        hasher->buf_len += n;
+        ptr += n;
+        len -= n;
+        if (hasher->buf_len != sizeof(hasher->buf))
+            return;
+        xxh_stripes(hasher->acc, hasher->buf, sizeof(hasher->buf));
+        hasher->buf_len = 0;
+    }
+
+    size_t n = xxh_stripes(hasher->acc, ptr, len);
+    if (len != n)
+        memcpy(hasher->buf, ptr + n, len - n);
+    hasher->buf_len = len - n;
+}
+
+ARF_API uint64_t arf_hasher_finish(const struct arf_hasher *hasher) {
+    uint64_t h;
+    if (hasher->total_len >= 32) {
+        const uint64_t *acc = hasher->acc;
+        h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) +
+            rotl64(acc[3], 18);
+        h = xxh_merge(h, acc[0]);
+        h = xxh_merge(h, acc[1]);
+        h = xxh_merge(h, acc[2]);
+        h = xxh_merge(h, acc[3]);
+    } else {
+        h = hasher->seed + xxh_prime5;
+    }
+    h += hasher->total_len;
+
+    const uint8_t *ptr = hasher->buf;
+    size_t len = hasher->buf_len;
+    for (; len >= 8; ptr += 8, len -= 8) {
+        h ^= xxh_round(0, read_le64(ptr));
+        h = rotl64(h, 27) * xxh_prime1 + xxh_prime4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read_le32(ptr) * xxh_prime1;
+        h = rotl64(h, 23) * xxh_prime2 + xxh_prime3;
+        ptr += 4;
+        len -= 4;
+    }
+    for (; len != 0; ++ptr, --len) {
+        h ^= *ptr * xxh_prime5;
+        h = rotl64(h, 11) * xxh_prime1;
+    }
+
+    h ^= h >> 33;
+    h *= xxh_prime2;
+    h ^= h >> 29;
+    h *= xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// An iterator over the host bytes which a UTF-8 form, or host data itself,
+// represents, as runs of bytes which can be read in place, plus the bytes
+// decoded from escapes.
+struct host_runs {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    bool escaped;
+    uint8_t byte;
+};
+
+static inline void host_runs_init(struct host_runs *runs, const uint8_t *ptr,
+                                  size_t len) {
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    runs->ptr = nul ? nul + 1 : ptr;
+    runs->end = ptr + len;
+    runs->escaped = nul != NULL;
+}
+
+static inline void host_runs_init_view(struct host_runs *runs,
+                                       const struct arf_view *view) {
+    runs->ptr = view->escapes ? view->ptr + view->nul + 1 : view->ptr;
+    runs->end = view->ptr + view->len;
+    runs->escaped = view->escapes != 0;
+}
+
+static inline void host_runs_init_host(struct host_runs *runs,
+                                       const uint8_t *ptr, size_t len) {
+    runs->ptr = ptr;
+    runs->end = ptr + len;
+    runs->escaped = false;
+}
+
+// Set *run to the next run and return its length, or return 0 at the end.
+static inline size_t host_runs_next(struct host_runs *runs,
+                                    const uint8_t **run) {
+    const uint8_t *ptr = runs->ptr;
+    if (ptr == runs->end)
+        return 0;
+
+    if (!runs->escaped) {
+        *run = ptr;
+        runs->ptr = runs->end;
+        return (size_t)(runs->end - ptr);
+    }
+
+    // Escapes decode to a single byte. A truncated one at the end, which a
+    // valid ARF string wouldn't have, stands for itself.
+    if (*ptr == '\0' && runs->end - ptr >= 2) {
+        runs->byte = ptr[1] | (uint8_t)INT8_MIN;
+        runs->ptr = ptr + sizeof_escaped_byte;
+        *run = &runs->byte;
+        return 1;
+    }
+
+    const uint8_t *nul = memchr(ptr + 1, '\0', (size_t)(runs->end - ptr - 1));
+    runs->ptr = nul ? nul : runs->end;
+    *run = ptr;
+    return (size_t)(runs->ptr - ptr);
+}
+
+ARF_API void arf_hasher_update_utf8(struct arf_hasher *hasher,
+                                    const uint8_t *ptr, size_t len) {
+    struct host_runs runs;
+    const uint8_t *run;
+    size_t run_len;
+
+    host_runs_init(&runs, ptr, len);
+    while ((run_len = host_runs_next(&runs, &run)) != 0)
+        arf_hasher_update(hasher, run, run_len);
+}
+
+ARF_API uint64_t arf_hash_host(uint64_t seed, const uint8_t *ptr, size_t len) {
+    struct arf_hasher hasher;
+    arf_hasher_init(&hasher, seed);
+    arf_hasher_update(&hasher, ptr, len);
+    return arf_hasher_finish(&hasher);
+}
+
+ARF_API uint64_t arf_hash(uint64_t seed, const uint8_t *ptr, size_t len) {
+    struct arf_hasher hasher;
+    arf_hasher_init(&hasher, seed);
+    arf_hasher_update_utf8(&hasher, ptr, len);
+    return arf_hasher_finish(&hasher);
+}
+
+// Compare the host bytes of two iterators, like `memcmp`, with a proper
+// prefix ordered first.
+static int compare_runs(struct host_runs *a, struct host_runs *b) {
+    const uint8_t *a_run = NULL, *b_run = NULL;
+    size_t a_len = 0, b_len = 0;
+
+    for (;;) {
+        if (a_len == 0)
+            a_len = host_runs_next(a, &a_run);
+        if (b_len == 0)
+            b_len = host_runs_next(b, &b_run);
+        if (a_len == 0 || b_len == 0)
+            return (b_len == 0) - (a_len == 0);
+
+        size_t n = a_len < b_len ? a_len : b_len;
+        int c = memcmp(a_run, b_run, n);
+        if (c != 0)
+            return c;
+        a_run += n;
+        a_len -= n;
+        b_run += n;
+        b_len -= n;
+    }
+}
+
+ARF_API bool arf_equal(const uint8_t *a, size_t a_len, const uint8_t *b,
+                       size_t b_len) {
+    // Identical forms are equal, and two plain UTF-8 strings are their own
+    // host bytes. Otherwise, one or both may be an ARF string which escapes
+    // bytes it needn't have, so compare the host bytes.
+    if (a_len == b_len && (a_len == 0 || memcmp(a, b, a_len) == 0))
+        return true;
+    if (!arf_has_arf_magic(a, a_len) && !arf_has_arf_magic(b, b_len))
+        return false;
+    return arf_compare(a, a_len, b, b_len) == 0;
+}
+
+ARF_API bool arf_equal_host(const uint8_t *ptr, size_t len, const uint8_t *host,
+                            size_t host_len) {
+    return arf_compare_host(ptr, len, host, host_len) == 0;
+}
+
+ARF_API int arf_compare(const uint8_t *a, size_t a_len, const uint8_t *b,
+                        size_t b_len) {
+    struct host_runs a_runs, b_runs;
+    host_runs_init(&a_runs, a, a_len);
+    host_runs_init(&b_runs, b, b_len);
+    return compare_runs(&a_runs, &b_runs);
+}
+
+ARF_API int arf_compare_host(const uint8_t *ptr, size_t len,
+                             const uint8_t *host, size_t host_len) {
+    struct host_runs a_runs, b_runs;
+    host_runs_init(&a_runs, ptr, len);
+    host_runs_init_host(&b_runs, host, host_len);
+    return compare_runs(&a_runs, &b_runs);
+}
+
+ARF_API enum arf_status arf_view_init(struct arf_view *view,
+                                      const uint8_t *ptr, size_t len) {
+    const uint8_t *nul = memchr(ptr, '\0', len);
+    ARF_STAT(calls, 1);
+
+    view->ptr = ptr;
+    view->len = len;
+    if (__builtin_expect(nul == NULL, true)) {
+        if (find_invalid_utf8(ptr, len) != ptr + len) {
+            ARF_STAT(validation_failures, 1);
+            return ARF_INVALID;
+        }
+        ARF_STAT(fast_path, 1);
+        view->nul = len;
+        view->escapes = 0;
+        view->host_len = len;
+        return ARF_OK;
+    }
+
+    // Validate and size without decoding. Each escape takes two bytes of
+    // the NUL-escaped portion and decodes to one.
+    size_t size;
+    if (decode_arf(ptr, len, nul, NULL, 0, &size) == ARF_INVALID) {
+        ARF_STAT(validation_failures, 1);
+        return ARF_INVALID;
+    }
+    view->nul = (size_t)(nul - ptr);
+    view->host_len = size - 1;
+    view->escapes = len - view->nul - 1 - view->host_len;
+    return ARF_OK;
+}
+
+ARF_API void arf_view_c_str(const struct arf_view *view,
+                            char *__restrict__ c_str) {
+    uint8_t *out = (uint8_t *)c_str;
+    ARF_STAT(calls, 1);
+    if (__builtin_expect(view->escapes == 0, true)) {
+        ARF_STAT(fast_path, 1);
+        memcpy(out, view->ptr, view->len);
+    } else {
+        ARF_STAT(arf_decodes, 1);
+        copy_escaped(view->ptr + view->nul + 1, view->ptr + view->len, out);
+    }
+    out[view->host_len] = '\0';
+}
+
+ARF_API const uint8_t *arf_view_lossy(const struct arf_view *view,
+                                      size_t *len) {
+    if (view->escapes == 0) {
+        *len = view->len;
+        return view->ptr;
+    }
+    *len = view->nul - sizeof(utf8_bom);
+    return view->ptr + sizeof(utf8_bom);
+}
+
+ARF_API uint64_t arf_view_hash(uint64_t seed, const struct arf_view *view) {
+    if (view->escapes == 0)
+        return arf_hash_host(seed, view->ptr, view->len);
+
+    struct arf_hasher hasher;
+    struct host_runs runs;
+    const uint8_t *run;
+    size_t run_len;
+    arf_hasher_init(&hasher, seed);
+    host_runs_init_view(&runs, view);
+    while ((run_len = host_runs_next(&runs, &run)) != 0)
+        arf_hasher_update(&hasher, run, run_len);
+    return arf_hasher_finish(&hasher);
+}
+
+ARF_API int arf_view_compare(const struct arf_view *a,
+                             const struct arf_view *b) {
+    // Plain strings are their own host bytes.
+    if (a->escapes == 0 && b->escapes == 0) {
+        size_t n = a->len < b->len ? a->len : b->len;
+        int c = n ? memcmp(a->ptr, b->ptr, n) : 0;
+        return c != 0 ? c : (a->len > b->len) - (a->len < b->len);
+    }
+
+    struct host_runs a_runs, b_runs;
+    host_runs_init_view(&a_runs, a);
+    host_runs_init_view(&b_runs, b);
+    return compare_runs(&a_runs, &b_runs);
+}
+
+ARF_API bool arf_scan_init(struct arf_scan *scan, const uint8_t *in,
+                           size_t len, uint64_t *restrict bitmap) {
+    const uint8_t *end = in + len;
+    const uint8_t *invalid = find_invalid_utf8(in, len);
+    ARF_STAT(calls, 1);
+
+    scan->ptr = in;
+    scan->len = len;
+    scan->invalid = 0;
+    scan->bitmap = bitmap;
+    if (__builtin_expect(invalid == end, true)) {
+        ARF_STAT(fast_path, 1);
+        return true;
+    }
+
+    // Count every invalid byte, so that sizing doesn't need to look, and mark
+    // each one, so that encoding doesn't either.
+    memset(bitmap, 0, ARF_SCAN_WORDS(len) * sizeof(*bitmap));
+    do {
+        size_t at = (size_t)(invalid - in);
+        bitmap[at / 64] |= (uint64_t)1 << (at % 64);
+        scan->invalid += 1;
+        invalid = find_invalid_utf8(invalid + 1, (size_t)(end - invalid - 1));
+    } while (invalid != end);
+    return false;
+}
+
+ARF_API size_t arf_scan_size(const struct arf_scan *scan) {
+    if (scan->invalid == 0)
+        return scan->len;
+
+    // Each invalid byte becomes a two-byte escape in the NUL-escaped portion
+    // and a three-byte replacement character in the lossy portion.
+    size_t escaped_len, lossy_len, total;
+    if (__builtin_add_overflow(scan->len, scan->invalid, &escaped_len) ||
+        __builtin_add_overflow(escaped_len, scan->invalid, &lossy_len) ||
+        __builtin_add_overflow(lossy_len, escaped_len, &total) ||
+        __builtin_add_overflow(total, sizeof(utf8_bom) + 1, &total))
+    {
+        return SIZE_MAX;
+    }
+    return total;
+}
+
+ARF_API size_t arf_scan_encode(const struct arf_scan *scan, uint8_t *out,
+                               size_t cap) {
+    const uint8_t *in = scan->ptr;
+    size_t len = scan->len;
+    ARF_STAT(calls, 1);
+
+    if (__builtin_expect(scan->invalid == 0, true)) {
+        ARF_STAT(fast_path, 1);
+        if (len <= cap && len != 0)
+            memcpy(out, in, len);
+        return len;
+    }
+
+    size_t total = arf_scan_size(scan);
+    if (total > cap)
+        return total;
+    ARF_STAT(arf_encodes, 1);
+    ARF_STAT(invalid_bytes, scan->invalid);
+
+    // Both portions are the same runs of valid UTF-8 between the invalid
+    // bytes, so write each run into both at once.
+    size_t lossy_len = sizeof(utf8_bom) + len + 2 * scan->invalid;
+    uint8_t *lossy = out;
+    uint8_t *escaped = out + lossy_len + 1;
+    memcpy(lossy, utf8_bom, sizeof(utf8_bom));
+    lossy += sizeof(utf8_bom);
+
+    size_t pos = 0;
+    for (size_t word = 0; word != ARF_SCAN_WORDS(len); ++word) {
+        for (uint64_t bits = scan->bitmap[word]; bits != 0; bits &= bits - 1) {
+            size_t at = word * 64 + (size_t)__builtin_ctzll(bits);
+            size_t run = at - pos;
+            memcpy(lossy, in + pos, run);
+            memcpy(lossy + run, utf8_replacement, sizeof(utf8_replacement));
+            lossy += run + sizeof(utf8_replacement);
+            memcpy(escaped, in + pos, run);
+            escaped[run] = '\0';
+            escaped[run + 1] = in[at] & INT8_MAX;
+            escaped += run + sizeof_escaped_byte;
+            pos = at + 1;
+        }
+    }
+    memcpy(lossy, in + pos, len - pos);
+    lossy[len - pos] = '\0';
+    memcpy(escaped, in + pos, len - pos);
+
+    return total;
+}
@@ -7,47 +7,531 @@
 #include <stdbool.h>
 #endif
 
+/// Prefixes every function declared here. `arf_inline.h` defines it as
+/// `static inline` to compile the library into the including file.
+#ifndef ARF_API
+#define ARF_API
+#endif
+
+/// Marks functions which are pure except for counting their work. Builds
+/// with `ARF_STATS` must define it for the library's callers as well, so that
+/// the compiler doesn't combine or drop the calls that count.
+#ifdef ARF_STATS
+#define ARF_PURE
+#else
+#define ARF_PURE __attribute__((__pure__))
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/// Results of conversions which validate their input.
+enum arf_status {
+    /// The conversion succeeded.
+    ARF_OK,
+    /// The input is neither plain UTF-8 nor a valid ARF string.
+    ARF_INVALID,
+    /// The output buffer is too small. The required size has been stored.
+    ARF_TOO_SMALL,
+    /// Memory allocation failed.
+    ARF_NO_MEMORY,
+};
+
+/// A bump allocator for conversion results. Results are carved out of large
+/// chunks, and all of them are freed together by `arf_arena_reset` or
+/// `arf_arena_destroy`.
+struct arf_arena {
+    struct arf_arena_chunk *chunk;
+    uint8_t *next;
+    uint8_t *end;
+};
+
 /// Test whether the provided C-string is already valid UTF-8.
-bool arf_is_valid_c_str(const char *c_str)
-    __attribute__((__pure__, __nonnull__(1), __nothrow__));
+ARF_API bool arf_is_valid_c_str(const char *c_str)
+    ARF_PURE __attribute__((__nonnull__(1), __nothrow__));
+
+/// Return the length of the longest prefix of the `len` bytes at `ptr` which
+/// is valid UTF-8. It's `len` exactly when they're all valid.
+ARF_API size_t arf_utf8_valid_up_to(const uint8_t *ptr, size_t len)
+    ARF_PURE __attribute__((__nothrow__));
+
+/// The UTF-8 validation kernels, which `arf_utf8_valid_up_to_with` runs
+/// directly so that tests and benchmarks can compare them.
+enum arf_utf8_kernel {
+    /// The kernel selected for the running CPU, which everything else uses.
+    ARF_UTF8_KERNEL_AUTO,
+    /// The reference implementation, one sequence at a time.
+    ARF_UTF8_KERNEL_SCALAR,
+    /// The portable kernel, which skips ASCII a word at a time.
+    ARF_UTF8_KERNEL_WORD,
+    /// The x86-64 vector kernels.
+    ARF_UTF8_KERNEL_SSE2,
+    ARF_UTF8_KERNEL_SSSE3,
+    ARF_UTF8_KERNEL_AVX2,
+    ARF_UTF8_KERNEL_AVX512
+};
+
+/// Return what `arf_utf8_valid_up_to` would, using `kernel` to find the
+/// first invalid byte, or `SIZE_MAX` if the library wasn't built with that
+/// kernel or the CPU doesn't support it.
+ARF_API size_t arf_utf8_valid_up_to_with(enum arf_utf8_kernel kernel,
+                                         const uint8_t *ptr, size_t len)
+    __attribute__((__nothrow__));
 
 /// Quickly test whether the provided buffer looks like an ARF string.
-bool arf_has_arf_magic(const uint8_t *ptr, size_t len)
+ARF_API bool arf_has_arf_magic(const uint8_t *ptr, size_t len)
     __attribute__((__pure__, __nothrow__));
 
 /// Test whether the provided buffer is a valid ARF string.
-bool arf_is_valid_arf(const uint8_t *ptr, size_t len)
-    __attribute__((__pure__, __nothrow__));
+ARF_API bool arf_is_valid_arf(const uint8_t *ptr, size_t len)
+    ARF_PURE __attribute__((__nothrow__));
 
 /// Test whether the provided C-string is already valid UTF-8. If it is, store
 /// the length in *len and return true. If it isn't, store the length of the ARF
 /// string needed to represent it in *len and return false.
-bool arf_categorize_c_str(const char *c_str, size_t *__restrict__ len)
+ARF_API bool arf_categorize_c_str(const char *c_str, size_t *__restrict__ len)
     __attribute__((__nonnull__(1, 2), __nothrow__));
 
 /// Return the length of an ARF string for the given C-string. Returns
 /// `SIZE_MAX` on overflow.
-size_t arf_sizeof_c_str_arf(const char *c_str)
-    __attribute__((__pure__, __nonnull__(1), __nothrow__));
+ARF_API size_t arf_sizeof_c_str_arf(const char *c_str)
+    ARF_PURE __attribute__((__nonnull__(1), __nothrow__));
 
 /// Write the ARF string for the given C-string into the provided buffer. Use
 /// `arf_sizeof_c_str_arf` to determine the required buffer size.
-void arf_c_str_arf(const char *c_str, uint8_t *__restrict__ ptr)
+ARF_API void arf_c_str_arf(const char *c_str, uint8_t *__restrict__ ptr)
     __attribute__((__nonnull__(1, 2), __nothrow__));
 
+/// Write the UTF-8 form of the `len` host bytes at `in` into `out`: the bytes
+/// themselves if they're already valid UTF-8, and their ARF string otherwise.
+/// The input is scanned once. Like `snprintf`, this returns the length of the
+/// full result, and only writes all of it if that's no more than `cap`, so
+/// callers can try a stack buffer first and retry with a buffer of the
+/// returned size. If it's more, the contents of the `cap` bytes at `out` are
+/// unspecified, since an ARF string is written as far as it fits while it's
+/// being sized. Returns `SIZE_MAX` on overflow. The input must not contain NUL
+/// bytes.
+ARF_API size_t arf_encode(const uint8_t *in, size_t len,
+                          uint8_t *__restrict__ out, size_t cap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Return the size of the buffer `arf_c_strs_arf` needs for the NULL-terminated
+/// array `c_strs`, and store the number of strings in *count, as WASI's
+/// `args_sizes_get` and `environ_sizes_get` report them. Returns `SIZE_MAX` on
+/// overflow.
+ARF_API size_t arf_sizeof_c_strs_arf(const char *const *c_strs,
+                                     size_t *__restrict__ count)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Write the strings in the NULL-terminated array `c_strs` into `buf`, one
+/// after another and each followed by a NUL, and store the offset of each one
+/// in `offsets`, as WASI's `args_get` and `environ_get` lay them out. Strings
+/// that are valid UTF-8 are copied as-is and the rest are written as ARF
+/// strings. Since ARF strings contain NULs, the length of each string is the
+/// distance to the next offset, or to the end of the buffer, minus one. Use
+/// `arf_sizeof_c_strs_arf` to determine the required buffer size and number of
+/// offsets.
+ARF_API void arf_c_strs_arf(const char *const *c_strs,
+                            uint8_t *__restrict__ buf,
+                            size_t *__restrict__ offsets)
+    __attribute__((__nonnull__(1, 2, 3), __nothrow__));
+
 /// Return the length of a C-string for the given ARF.
-size_t arf_sizeof_arf_c_str(const uint8_t *ptr, size_t len)
-    __attribute__((__pure__, __nonnull__(1), __nothrow__));
+ARF_API size_t arf_sizeof_arf_c_str(const uint8_t *ptr, size_t len)
+    ARF_PURE __attribute__((__nonnull__(1), __nothrow__));
 
 /// Write the C-string for the given ARF into the provided buffer. Use
 /// `arf_sizeof_arf_c_str` to determine the required buffer size.
-void arf_arf_c_str(const uint8_t *ptr, size_t len, char *__restrict__ c_str)
+ARF_API void arf_arf_c_str(const uint8_t *ptr, size_t len,
+                           char *__restrict__ c_str)
+    __attribute__((__nonnull__(1, 3), __nothrow__));
+
+/// Convert the `len` bytes at `ptr`, which are either plain UTF-8 or an ARF
+/// string, into a C-string in the `cap` bytes at `c_str`. The input is
+/// validated and decoded in a single pass, so there's no need to call
+/// `arf_is_valid_arf` first. On `ARF_OK` or `ARF_TOO_SMALL`, store the size of
+/// the C-string, including the terminating NUL, in *size.
+ARF_API enum arf_status arf_decode(const uint8_t *ptr, size_t len,
+                                   char *__restrict__ c_str, size_t cap,
+                                   size_t *__restrict__ size)
+    __attribute__((__nonnull__(1, 5), __nothrow__));
+
+/// Like `arf_decode`, but for input which is known to be plain UTF-8 or a
+/// valid ARF string, such as one this host produced and got back unmodified.
+/// Nothing is validated; the escaped portion is found with `memchr` and copied
+/// out in runs. `c_str` must have room for `len + 1` bytes. Returns the size
+/// of the C-string, including the terminating NUL. Building with
+/// `ARF_CHECK_TRUSTED` defined validates the input anyway, and aborts if it's
+/// invalid.
+ARF_API size_t arf_decode_trusted(const uint8_t *ptr, size_t len,
+                                  char *__restrict__ c_str)
+    __attribute__((__nonnull__(1, 3), __nothrow__));
+
+/// Like `arf_decode`, but decode the `len` bytes at `buf` over themselves,
+/// leaving a C-string at `buf`, for callers which already hold the input in a
+/// buffer of their own. `cap` is the size of the buffer, at least `len`. An
+/// ARF string always decodes to fewer bytes than it has, so it always fits;
+/// plain UTF-8 needs one more byte for the terminating NUL. If this doesn't
+/// return `ARF_OK`, the contents of the buffer are unspecified.
+ARF_API enum arf_status arf_decode_in_place(uint8_t *buf, size_t len,
+                                            size_t cap,
+                                            size_t *__restrict__ size)
+    __attribute__((__nonnull__(1, 4), __nothrow__));
+
+/// Initialize an empty arena. This doesn't allocate.
+ARF_API void arf_arena_init(struct arf_arena *arena)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Free everything allocated from the arena, keeping its most recent chunk
+/// for reuse.
+ARF_API void arf_arena_reset(struct arf_arena *arena)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Free all of the arena's memory. It may be reused after `arf_arena_init`.
+ARF_API void arf_arena_destroy(struct arf_arena *arena)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Like `arf_encode`, but store a pointer to the result and its length in *out
+/// and *out_len instead of writing into a caller-provided buffer. Valid UTF-8
+/// is returned as a view of the input without copying; ARF strings are
+/// allocated from `arena`. Returns `ARF_OK` or `ARF_NO_MEMORY`.
+ARF_API enum arf_status arf_encode_in(struct arf_arena *arena,
+                                      const uint8_t *in, size_t len,
+                                      const uint8_t **out, size_t *out_len)
+    __attribute__((__nonnull__(1, 2, 4, 5), __nothrow__));
+
+/// Like `arf_decode`, but allocate the C-string from `arena` and store a
+/// pointer to it in *c_str. The C-string is always a copy, since the input
+/// isn't NUL-terminated.
+ARF_API enum arf_status arf_decode_in(struct arf_arena *arena,
+                                      const uint8_t *ptr, size_t len,
+                                      const char **c_str, size_t *size)
+    __attribute__((__nonnull__(1, 2, 4, 5), __nothrow__));
+
+/// Write the UTF-8 form of the `len` UTF-16 code units at `in`, as on Windows
+/// hosts: the transcoded string if it's valid UTF-16, and otherwise its ARF
+/// string, in which each unpaired surrogate is replaced by U+FFFD in the lossy
+/// portion and escaped in the NUL-escaped portion as its offset from U+D800.
+/// Like `arf_encode`, this returns the length of the full result, and only
+/// writes it if that's no more than `cap` bytes. Returns `SIZE_MAX` on
+/// overflow. The input must not contain NUL units.
+ARF_API size_t arf_encode_utf16(const uint16_t *in, size_t len,
+                                uint8_t *__restrict__ out, size_t cap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Convert the `len` bytes at `ptr`, which are either plain UTF-8 or an ARF
+/// string in the Windows scheme, into a NUL-terminated UTF-16 string in the
+/// `cap` code units at `out`. On `ARF_OK` or `ARF_TOO_SMALL`, store the number
+/// of code units, including the terminating NUL, in *size.
+ARF_API enum arf_status arf_decode_utf16(const uint8_t *ptr, size_t len,
+                                         uint16_t *__restrict__ out, size_t cap,
+                                         size_t *__restrict__ size)
+    __attribute__((__nonnull__(1, 5), __nothrow__));
+
+/// Incrementally convert a C-string which arrives in arbitrary chunks into
+/// its ARF string, producing the same bytes as `arf_c_str_arf`. The lossy
+/// portion is written out as the input arrives; the NUL-escaped portion, which
+/// comes after it, is held by the encoder until `arf_encoder_finish`.
+struct arf_encoder {
+    uint8_t *escaped;
+    size_t escaped_len;
+    size_t escaped_cap;
+    uint8_t pending[3];
+    uint8_t pending_len;
+    bool started;
+};
+
+/// Initialize an encoder. This doesn't allocate.
+ARF_API void arf_encoder_init(struct arf_encoder *enc)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Encode the next `len` bytes of input, which may split UTF-8 sequences
+/// anywhere, and write the resulting ARF bytes to `out`, which must have room
+/// for `3 * (len + 4)` bytes. Return the number of bytes written, or `SIZE_MAX`
+/// if memory allocation fails.
+ARF_API size_t arf_encoder_update(struct arf_encoder *enc, const uint8_t *in,
+                                  size_t len, uint8_t *__restrict__ out)
+    __attribute__((__nonnull__(1, 4), __nothrow__));
+
+/// Return the number of bytes `arf_encoder_finish` will write.
+ARF_API size_t arf_sizeof_encoder_finish(const struct arf_encoder *enc)
+    ARF_PURE __attribute__((__nonnull__(1), __nothrow__));
+
+/// Write the rest of the ARF string to `out`, and return the number of bytes
+/// written. Use `arf_sizeof_encoder_finish` to determine the required buffer
+/// size. Returns `SIZE_MAX` if memory allocation fails.
+ARF_API size_t arf_encoder_finish(struct arf_encoder *enc,
+                                  uint8_t *__restrict__ out)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Free the encoder's memory. It may be reused after `arf_encoder_init`.
+ARF_API void arf_encoder_destroy(struct arf_encoder *enc)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Incrementally convert an ARF string which arrives in arbitrary chunks into
+/// its C-string, producing the same bytes as `arf_arf_c_str`. The lossy
+/// portion is held by the decoder so that the NUL-escaped portion can be
+/// checked against it and written out as it arrives.
+struct arf_decoder {
+    uint8_t *lossy;
+    size_t lossy_len;
+    size_t lossy_cap;
+    size_t matched;
+    uint8_t state;
+    uint8_t bom_len;
+    bool any_invalid_bytes;
+};
+
+/// Initialize a decoder. This doesn't allocate.
+ARF_API void arf_decoder_init(struct arf_decoder *dec)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Decode the next `len` bytes of input and write the resulting C-string
+/// bytes to `out`, which must have room for `len` bytes. Return the number of
+/// bytes written, or `SIZE_MAX` if the input is invalid or memory allocation
+/// fails, in which case `arf_decoder_finish` says which. Since the input is
+/// validated as it arrives, output written before an error is detected must
+/// be discarded.
+ARF_API size_t arf_decoder_update(struct arf_decoder *dec, const uint8_t *in,
+                                  size_t len, char *__restrict__ out)
+    __attribute__((__nonnull__(1, 4), __nothrow__));
+
+/// Check that the input formed a complete, valid ARF string, and if so, write
+/// the terminating NUL to `out` and return `ARF_OK`. Otherwise, return
+/// `ARF_INVALID` or `ARF_NO_MEMORY`.
+ARF_API enum arf_status arf_decoder_finish(struct arf_decoder *dec,
+                                           char *__restrict__ out)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Free the decoder's memory. It may be reused after `arf_decoder_init`.
+ARF_API void arf_decoder_destroy(struct arf_decoder *dec)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Append the path component `name`, the `name_len` bytes of host data at
+/// `name`, to `base`, which is either plain UTF-8 or an ARF string, adding a
+/// slash between them if `base` is non-empty and doesn't already end with
+/// one. Write the resulting UTF-8 form to `out`, if it fits within `cap`
+/// bytes, and return its size, or `SIZE_MAX` on overflow. `base` isn't
+/// validated or decoded, only copied, so this does work proportional to the
+/// length of `name`, plus copying; but if it contains a NUL without starting
+/// as an ARF string does, this returns `SIZE_MAX`. `out` may be `base`, to
+/// append in place.
+ARF_API size_t arf_path_join(const uint8_t *base, size_t base_len,
+                             const uint8_t *name, size_t name_len, uint8_t *out,
+                             size_t cap)
     __attribute__((__nonnull__(1, 3), __nothrow__));
 
+/// Write the UTF-8 form of the parent of `path`, which is either plain UTF-8
+/// or an ARF string, to `out`, if it fits within `cap` bytes, and return its
+/// size. This follows `dirname`: trailing slashes are ignored, a path with no
+/// slashes has the parent ".", and "/" is its own parent. The result is an
+/// ARF string only if it still contains invalid bytes. It's never longer than
+/// `path`, and `out` may be `path`.
+ARF_API size_t arf_path_parent(const uint8_t *path, size_t len, uint8_t *out,
+                               size_t cap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Write the UTF-8 form of the last component of `path`, which is either
+/// plain UTF-8 or an ARF string, to `out`, if it fits within `cap` bytes, and
+/// return its size. This follows `basename`: trailing slashes are ignored,
+/// "/" is its own basename, and the empty path has the basename ".". The
+/// result is an ARF string only if it still contains invalid bytes. It's
+/// never longer than `path`, and `out` may be `path`.
+ARF_API size_t arf_path_basename(const uint8_t *path, size_t len, uint8_t *out,
+                                 size_t cap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// A streaming hasher for host bytes, which computes XXH64. Feed it host
+/// data with `arf_hasher_update`, and UTF-8 forms, which it hashes as the host
+/// bytes they represent, with `arf_hasher_update_utf8`, in any mix and in
+/// pieces of any size; the result depends only on the bytes.
+struct arf_hasher {
+    uint64_t acc[4];
+    uint64_t seed;
+    uint64_t total_len;
+    uint8_t buf[32];
+    size_t buf_len;
+};
+
+/// Initialize a hasher with `seed`.
+ARF_API void arf_hasher_init(struct arf_hasher *hasher, uint64_t seed)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Hash the `len` bytes of host data at `ptr`.
+ARF_API void arf_hasher_update(struct arf_hasher *hasher, const uint8_t *ptr,
+                               size_t len)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Hash the host bytes represented by the `len` bytes at `ptr`, which are
+/// either plain UTF-8 or an ARF string. ARF strings aren't validated; the
+/// bytes of their NUL-escaped portion are hashed directly, with the escapes
+/// decoded.
+ARF_API void arf_hasher_update_utf8(struct arf_hasher *hasher,
+                                    const uint8_t *ptr, size_t len)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Return the hash of everything fed to the hasher so far. The hasher may
+/// continue to be updated.
+ARF_API uint64_t arf_hasher_finish(const struct arf_hasher *hasher)
+    __attribute__((__nonnull__(1), __nothrow__, __pure__));
+
+/// Return the XXH64 hash, with `seed`, of the `len` bytes of host data at
+/// `ptr`.
+ARF_API uint64_t arf_hash_host(uint64_t seed, const uint8_t *ptr, size_t len)
+    __attribute__((__nothrow__, __pure__));
+
+/// Return the same hash as `arf_hash_host` would for the host bytes which the
+/// `len` bytes at `ptr`, either plain UTF-8 or an ARF string, represent,
+/// without decoding them. Hash tables keyed by host bytes can be probed with
+/// either form.
+ARF_API uint64_t arf_hash(uint64_t seed, const uint8_t *ptr, size_t len)
+    __attribute__((__nothrow__, __pure__));
+
+/// Test whether two UTF-8 forms represent the same host bytes. Identical
+/// forms and plain UTF-8 are compared directly; ARF strings are compared by
+/// their host bytes, since one may escape bytes which didn't need escaping.
+ARF_API bool arf_equal(const uint8_t *a, size_t a_len, const uint8_t *b,
+                       size_t b_len)
+    __attribute__((__nothrow__, __pure__));
+
+/// Test whether the UTF-8 form at `ptr` represents the `host_len` bytes of
+/// host data at `host`, without decoding it.
+ARF_API bool arf_equal_host(const uint8_t *ptr, size_t len, const uint8_t *host,
+                            size_t host_len)
+    __attribute__((__nothrow__, __pure__));
+
+/// Compare the host bytes represented by two UTF-8 forms, without decoding
+/// them, and return a value less than, equal to, or greater than zero, as
+/// `memcmp` would for the host bytes, with a proper prefix ordered first.
+ARF_API int arf_compare(const uint8_t *a, size_t a_len, const uint8_t *b,
+                        size_t b_len)
+    __attribute__((__nothrow__, __pure__));
+
+/// Compare the host bytes represented by the UTF-8 form at `ptr` with the
+/// `host_len` bytes of host data at `host`, as `arf_compare` does.
+ARF_API int arf_compare_host(const uint8_t *ptr, size_t len,
+                             const uint8_t *host, size_t host_len)
+    __attribute__((__nothrow__, __pure__));
+
+/// A validated UTF-8 form, with what one pass over it learns, so that later
+/// operations on it needn't search or validate it again. Fill it in with
+/// `arf_view_init`; it refers to the string, which must outlive it.
+struct arf_view {
+    const uint8_t *ptr;
+    size_t len;
+    /// The offset of the NUL between the lossy and NUL-escaped portions of
+    /// an ARF string, or `len` for plain UTF-8. The NUL-escaped portion runs
+    /// from just after it to the end.
+    size_t nul;
+    /// The number of escaped bytes, which is zero exactly for plain UTF-8.
+    size_t escapes;
+    /// The length of the host string, not counting a terminating NUL.
+    size_t host_len;
+};
+
+/// Validate the `len` bytes at `ptr`, which should be plain UTF-8 or an ARF
+/// string, and describe them in *view. Returns `ARF_OK` or `ARF_INVALID`.
+ARF_API enum arf_status arf_view_init(struct arf_view *view,
+                                      const uint8_t *ptr, size_t len)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Write the host string `view` represents, and a terminating NUL, which is
+/// `view->host_len + 1` bytes, into the provided buffer.
+ARF_API void arf_view_c_str(const struct arf_view *view,
+                            char *__restrict__ c_str)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Return the string to display for `view`, and store its length in *len:
+/// the lossy portion of an ARF string, with invalid bytes shown as U+FFFD,
+/// or the plain UTF-8 itself. It's valid UTF-8 and isn't NUL-terminated.
+ARF_API const uint8_t *arf_view_lossy(const struct arf_view *view,
+                                      size_t *__restrict__ len)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Return the same hash as `arf_hash` would for the string `view` describes.
+ARF_API uint64_t arf_view_hash(uint64_t seed, const struct arf_view *view)
+    __attribute__((__nonnull__(2), __nothrow__, __pure__));
+
+/// Compare the host bytes represented by two views, as `arf_compare` does.
+ARF_API int arf_view_compare(const struct arf_view *a,
+                             const struct arf_view *b)
+    __attribute__((__nonnull__(1, 2), __nothrow__, __pure__));
+
+/// The number of words of bitmap `arf_scan_init` needs for `len` bytes.
+#define ARF_SCAN_WORDS(len) (((len) + 63) / 64)
+
+/// What one validation pass over a host string learns, so that it can be
+/// sized and encoded without being validated again. Fill it in with
+/// `arf_scan_init`; it refers to the string and the bitmap, which must
+/// outlive it.
+struct arf_scan {
+    const uint8_t *ptr;
+    size_t len;
+    /// The number of invalid bytes, which is zero exactly for plain UTF-8.
+    size_t invalid;
+    /// One bit per byte, in order from the low bit of the first word, set for
+    /// the invalid bytes. It's only written, and only meaningful, when there
+    /// are any.
+    uint64_t *bitmap;
+};
+
+/// Find the invalid bytes in the `len` host bytes at `in`, which must not
+/// contain NUL bytes, and describe them in *scan, recording them in
+/// `bitmap`, which must have room for `ARF_SCAN_WORDS(len)` words. Returns
+/// true if they're all valid UTF-8, as `arf_categorize_c_str` does.
+ARF_API bool arf_scan_init(struct arf_scan *scan, const uint8_t *in,
+                           size_t len, uint64_t *__restrict__ bitmap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Return the length of the UTF-8 form of the string `scan` describes, as
+/// `arf_encode` would, without looking at the string. Returns `SIZE_MAX` on
+/// overflow.
+ARF_API size_t arf_scan_size(const struct arf_scan *scan)
+    __attribute__((__nonnull__(1), __nothrow__, __pure__));
+
+/// Write the UTF-8 form of the string `scan` describes into `out`, as
+/// `arf_encode` does, including its return value. The runs between the
+/// invalid bytes recorded in the bitmap are copied into both portions of the
+/// ARF string without being validated again.
+ARF_API size_t arf_scan_encode(const struct arf_scan *scan,
+                               uint8_t *__restrict__ out, size_t cap)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Counters of the work done by conversions, kept when the library is built
+/// with `ARF_STATS` defined. Each thread counts into its own set, without
+/// synchronization, and `arf_stats_get` adds them all up. They cover the
+/// one-shot conversions, to and from ARF strings and UTF-16, and the arena
+/// conversions built on them.
+struct arf_stats {
+    /// Calls to conversion and validation functions, counting each string of
+    /// a batch separately.
+    uint64_t calls;
+    /// Strings which were plain UTF-8, and so took the fast path.
+    uint64_t fast_path;
+    /// Bytes checked by UTF-8 validation.
+    uint64_t bytes_scanned;
+    /// Invalid bytes escaped by ARF encoding passes.
+    uint64_t invalid_bytes;
+    /// ARF encoding passes, including those which only compute the size.
+    uint64_t arf_encodes;
+    /// ARF strings decoded.
+    uint64_t arf_decodes;
+    /// Inputs rejected as invalid.
+    uint64_t validation_failures;
+};
+
+/// Store the totals of every thread's counters since the last
+/// `arf_stats_reset` in *stats, and return true. If the library was built
+/// without `ARF_STATS`, store zeros and return false. Counts from other
+/// threads which are running conversions at the time may be slightly stale.
+ARF_API bool arf_stats_get(struct arf_stats *stats)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Start counting from zero again, for every thread.
+ARF_API void arf_stats_reset(void)
+    __attribute__((__nothrow__));
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,471 @@
+#ifndef ARF_HPP
+#define ARF_HPP
+
+//! C++17 interface to the ARF library: `std::string_view` overloads,
+//! conversions into caller-owned and allocator-aware strings, a host path
+//! type with inline storage, and compile-time encoding and decoding.
+
+#include "arf.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_lib_is_constant_evaluated)
+#define ARF_IS_CONSTANT_EVALUATED() std::is_constant_evaluated()
+#elif defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define ARF_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+#endif
+#ifndef ARF_IS_CONSTANT_EVALUATED
+#define ARF_IS_CONSTANT_EVALUATED() true
+#endif
+
+namespace arf {
+
+/// Returned by `decoded_size` for input which is neither plain UTF-8 nor a
+/// valid ARF string.
+inline constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+namespace detail {
+
+inline constexpr std::string_view utf8_bom{"\xef\xbb\xbf", 3};
+inline constexpr std::string_view utf8_replacement{"\xef\xbf\xbd", 3};
+
+inline const std::uint8_t *bytes(std::string_view s) noexcept {
+    return reinterpret_cast<const std::uint8_t *>(s.empty() ? "" : s.data());
+}
+
+// A compile-time copy of `utf8_sequence_len` in arf.c, which it must agree
+// with exactly.
+constexpr std::size_t utf8_sequence_len(std::string_view s,
+                                        std::size_t i) noexcept {
+    auto at = [&](std::size_t j) { return static_cast<unsigned char>(s[i + j]); };
+    std::size_t avail = s.size() - i;
+
+    if (at(0) < 0x80) {
+        return 1;
+    } else if ((at(0) & 0xe0) == 0xc0) {
+        if (avail < 2 || (at(0) & 0xfe) == 0xc0 || (at(1) & 0xc0) != 0x80)
+            return 0;
+        return 2;
+    } else if ((at(0) & 0xf0) == 0xe0) {
+        if (avail < 3 ||
+            (at(0) == 0xe0 && (at(1) & 0xe0) == 0x80) ||
+            (at(0) == 0xed && (at(1) & 0xe0) == 0xa0) ||
+            (at(0) == 0xef && at(1) == 0xbf && (at(2) & 0xfe) == 0xbe) ||
+            (at(1) & 0xc0) != 0x80 || (at(2) & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        return 3;
+    } else if ((at(0) & 0xf8) == 0xf0) {
+        if (avail < 4 || at(0) > 0xf4 ||
+            (at(0) == 0xf0 && (at(1) & 0xf0) == 0x80) ||
+            (at(0) == 0xf4 && at(1) > 0x8f) ||
+            (at(1) & 0xc0) != 0x80 || (at(2) & 0xc0) != 0x80 ||
+            (at(3) & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+constexpr bool is_valid_utf8(std::string_view s) noexcept {
+    for (std::size_t i = 0; i != s.size();) {
+        std::size_t n = utf8_sequence_len(s, i);
+        if (n == 0)
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+// Compute the UTF-8 form of `host`, as `arf_encode` does, writing it to
+// `out` unless that's null. Return its size.
+constexpr std::size_t encode(std::string_view host, char *out) noexcept {
+    std::size_t size = 0;
+    auto put = [&](std::string_view s) {
+        for (char c : s) {
+            if (out)
+                out[size] = c;
+            ++size;
+        }
+    };
+
+    if (is_valid_utf8(host)) {
+        put(host);
+        return size;
+    }
+
+    put(utf8_bom);
+    for (std::size_t i = 0; i != host.size();) {
+        std::size_t n = utf8_sequence_len(host, i);
+        put(n ? host.substr(i, n) : utf8_replacement);
+        i += n ? n : 1;
+    }
+    put(std::string_view("", 1));
+    for (std::size_t i = 0; i != host.size();) {
+        std::size_t n = utf8_sequence_len(host, i);
+        if (n) {
+            put(host.substr(i, n));
+            i += n;
+        } else {
+            char escape[] = {'\0', static_cast<char>(host[i] & 0x7f)};
+            put(std::string_view(escape, 2));
+            i += 1;
+        }
+    }
+    return size;
+}
+
+// Decode `utf8`, which is plain UTF-8 or an ARF string, as `arf_decode`
+// does, writing the host bytes (without a terminating NUL) to `out` unless
+// that's null. Return their number, or `npos` if `utf8` is invalid.
+constexpr std::size_t decode(std::string_view utf8, char *out) noexcept {
+    std::size_t nul = utf8.find('\0');
+    std::size_t len = 0;
+
+    if (nul == std::string_view::npos) {
+        if (!is_valid_utf8(utf8))
+            return npos;
+        for (char c : utf8) {
+            if (out)
+                out[len] = c;
+            ++len;
+        }
+        return len;
+    }
+
+    if (utf8.substr(0, utf8_bom.size()) != utf8_bom ||
+        !is_valid_utf8(utf8.substr(utf8_bom.size(), nul - utf8_bom.size())))
+    {
+        return npos;
+    }
+
+    std::size_t lossy = utf8_bom.size();
+    std::size_t escaped = nul + 1;
+    bool any_invalid_bytes = false;
+    while (lossy != nul) {
+        if (escaped == utf8.size())
+            return npos;
+        char c = utf8[escaped];
+        if (c != '\0') {
+            if (utf8[lossy] != c)
+                return npos;
+            ++lossy;
+            ++escaped;
+        } else {
+            if (utf8.size() - escaped < 2 ||
+                static_cast<unsigned char>(utf8[escaped + 1]) >= 0x80 ||
+                utf8.substr(lossy, utf8_replacement.size()) != utf8_replacement)
+            {
+                return npos;
+            }
+            c = static_cast<char>(utf8[escaped + 1] | 0x80);
+            lossy += utf8_replacement.size();
+            escaped += 2;
+            any_invalid_bytes = true;
+        }
+        if (out)
+            out[len] = c;
+        ++len;
+    }
+    if (escaped != utf8.size() || !any_invalid_bytes)
+        return npos;
+    return len;
+}
+
+// Not `constexpr`, so that reaching it during constant evaluation is a
+// compile-time error.
+inline std::size_t invalid_literal() noexcept { return npos; }
+
+constexpr std::size_t literal_encoded_size(std::string_view host) noexcept {
+    return host.find('\0') == std::string_view::npos ? encode(host, nullptr)
+                                                     : invalid_literal();
+}
+
+constexpr std::size_t literal_decoded_size(std::string_view utf8) noexcept {
+    std::size_t size = decode(utf8, nullptr);
+    return size != npos ? size : invalid_literal();
+}
+
+} // namespace detail
+
+/// A string of `N` bytes, followed by a NUL, which can be computed at
+/// compile time. Produced by `ARF_LITERAL` and `ARF_HOST_LITERAL`.
+template <std::size_t N> struct fixed_string {
+    char data[N + 1] = {};
+
+    constexpr std::size_t size() const noexcept { return N; }
+    constexpr const char *c_str() const noexcept { return data; }
+    constexpr std::string_view view() const noexcept { return {data, N}; }
+    constexpr operator std::string_view() const noexcept { return view(); }
+};
+
+/// Test whether `host` is already valid UTF-8.
+constexpr bool is_valid_utf8(std::string_view host) noexcept {
+    if (!ARF_IS_CONSTANT_EVALUATED())
+        return arf_encode(detail::bytes(host), host.size(), nullptr, 0) ==
+               host.size();
+    return detail::is_valid_utf8(host);
+}
+
+/// Return the size of the UTF-8 form of `host`: `host` itself if it's valid
+/// UTF-8, and its ARF string otherwise. `host` must not contain NUL bytes.
+constexpr std::size_t encoded_size(std::string_view host) noexcept {
+    if (!ARF_IS_CONSTANT_EVALUATED())
+        return arf_encode(detail::bytes(host), host.size(), nullptr, 0);
+    return detail::encode(host, nullptr);
+}
+
+/// Return the number of host bytes `utf8` decodes to, not counting a
+/// terminating NUL, or `npos` if it's neither plain UTF-8 nor a valid ARF
+/// string.
+constexpr std::size_t decoded_size(std::string_view utf8) noexcept {
+    if (!ARF_IS_CONSTANT_EVALUATED()) {
+        std::size_t size = 0;
+        return arf_decode(detail::bytes(utf8), utf8.size(), nullptr, 0, &size) ==
+                       ARF_INVALID
+                   ? npos
+                   : size - 1;
+    }
+    return detail::decode(utf8, nullptr);
+}
+
+/// Test whether `utf8` is a valid ARF string.
+inline bool is_arf(std::string_view utf8) noexcept {
+    return arf_is_valid_arf(detail::bytes(utf8), utf8.size());
+}
+
+/// Compute the UTF-8 form of `host` at compile time. `N` must be
+/// `encoded_size(host)`; `ARF_LITERAL` supplies it.
+template <std::size_t N>
+constexpr fixed_string<N> encode_fixed(std::string_view host) noexcept {
+    fixed_string<N> result;
+    if (detail::literal_encoded_size(host) == N)
+        detail::encode(host, result.data);
+    return result;
+}
+
+/// Compute the host bytes of `utf8` at compile time. `N` must be
+/// `decoded_size(utf8)`; `ARF_HOST_LITERAL` supplies it.
+template <std::size_t N>
+constexpr fixed_string<N> decode_fixed(std::string_view utf8) noexcept {
+    fixed_string<N> result;
+    if (detail::literal_decoded_size(utf8) == N)
+        detail::decode(utf8, result.data);
+    return result;
+}
+
+/// Write the UTF-8 form of `host` into `out`, replacing its contents and
+/// reusing its capacity. `host` must not contain NUL bytes, or overlap `out`.
+template <class Traits, class Allocator>
+arf_status encode(std::string_view host,
+                  std::basic_string<char, Traits, Allocator> &out) {
+    out.resize(out.capacity());
+    std::size_t size = arf_encode(detail::bytes(host), host.size(),
+                                  reinterpret_cast<std::uint8_t *>(out.data()),
+                                  out.size());
+    if (size == SIZE_MAX)
+        return ARF_NO_MEMORY;
+    if (size > out.size()) {
+        out.resize(size);
+        arf_encode(detail::bytes(host), host.size(),
+                   reinterpret_cast<std::uint8_t *>(out.data()), out.size());
+    }
+    out.resize(size);
+    return ARF_OK;
+}
+
+/// Decode `utf8`, which is plain UTF-8 or an ARF string, into host bytes in
+/// `out`, replacing its contents and reusing its capacity. `utf8` must not
+/// overlap `out`. On failure, `out` is left empty.
+template <class Traits, class Allocator>
+arf_status decode(std::string_view utf8,
+                  std::basic_string<char, Traits, Allocator> &out) {
+    std::size_t size;
+    out.resize(out.capacity());
+    arf_status status = arf_decode(detail::bytes(utf8), utf8.size(),
+                                   out.data(), out.size(), &size);
+    if (status == ARF_TOO_SMALL) {
+        out.resize(size);
+        status = arf_decode(detail::bytes(utf8), utf8.size(), out.data(),
+                            out.size(), &size);
+    }
+    out.resize(status == ARF_OK ? size - 1 : 0);
+    return status;
+}
+
+/// A NUL-terminated host path, stored inline if it fits in `N` bytes
+/// including the NUL, and otherwise in memory from `Allocator`.
+template <std::size_t N = 384, class Allocator = std::allocator<char>>
+class basic_host_path {
+    static_assert(N >= 1, "inline storage must hold at least the NUL");
+    static_assert(std::is_same_v<typename Allocator::value_type, char>,
+                  "allocator must allocate chars");
+
+    using alloc_traits = std::allocator_traits<Allocator>;
+
+public:
+    using allocator_type = Allocator;
+
+    basic_host_path() noexcept(noexcept(Allocator()))
+        : basic_host_path(Allocator()) {}
+
+    explicit basic_host_path(const Allocator &alloc) noexcept
+        : alloc_(alloc) {
+        inline_[0] = '\0';
+    }
+
+    basic_host_path(const basic_host_path &other)
+        : alloc_(alloc_traits::select_on_container_copy_construction(
+              other.alloc_)) {
+        inline_[0] = '\0';
+        assign(other.view());
+    }
+
+    basic_host_path(basic_host_path &&other) noexcept
+        : alloc_(std::move(other.alloc_)) {
+        take(other);
+    }
+
+    basic_host_path &operator=(const basic_host_path &other) {
+        if (this != &other)
+            assign(other.view());
+        return *this;
+    }
+
+    basic_host_path &operator=(basic_host_path &&other) {
+        if (this == &other)
+            return *this;
+        if (other.ptr_ != other.inline_ && alloc_ == other.alloc_) {
+            release();
+            take(other);
+        } else {
+            assign(other.view());
+        }
+        return *this;
+    }
+
+    ~basic_host_path() { release(); }
+
+    const char *c_str() const noexcept { return ptr_; }
+    const char *data() const noexcept { return ptr_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    std::string_view view() const noexcept { return {ptr_, size_}; }
+    operator std::string_view() const noexcept { return view(); }
+    allocator_type get_allocator() const noexcept { return alloc_; }
+
+private:
+    template <std::size_t M, class A>
+    friend arf_status decode(std::string_view utf8, basic_host_path<M, A> &out);
+    template <std::size_t M, class A>
+    friend void decode_trusted(std::string_view utf8,
+                               basic_host_path<M, A> &out);
+
+    // Make room for `cap` bytes, discarding the contents.
+    char *reserve(std::size_t cap) {
+        if (cap > cap_) {
+            char *ptr = alloc_traits::allocate(alloc_, cap);
+            release();
+            ptr_ = ptr;
+            cap_ = cap;
+        }
+        return ptr_;
+    }
+
+    void assign(std::string_view s) {
+        char *ptr = reserve(s.size() + 1);
+        std::memcpy(ptr, s.data(), s.size());
+        ptr[s.size()] = '\0';
+        size_ = s.size();
+    }
+
+    void release() noexcept {
+        if (ptr_ != inline_)
+            alloc_traits::deallocate(alloc_, ptr_, cap_);
+        ptr_ = inline_;
+        cap_ = N;
+    }
+
+    // Take the contents of `other`, which must have been released or be
+    // newly constructed, leaving `other` empty.
+    void take(basic_host_path &other) noexcept {
+        if (other.ptr_ == other.inline_) {
+            std::memcpy(inline_, other.inline_, other.size_ + 1);
+        } else {
+            ptr_ = other.ptr_;
+            cap_ = other.cap_;
+        }
+        size_ = other.size_;
+        other.ptr_ = other.inline_;
+        other.cap_ = N;
+        other.size_ = 0;
+        other.inline_[0] = '\0';
+    }
+
+    char *ptr_ = inline_;
+    std::size_t size_ = 0;
+    std::size_t cap_ = N;
+    Allocator alloc_;
+    char inline_[N];
+};
+
+using host_path = basic_host_path<>;
+
+/// Decode `utf8`, which is plain UTF-8 or an ARF string, into `out`. Paths
+/// which fit in `out`'s inline storage don't allocate. On failure, `out` is
+/// left empty.
+template <std::size_t N, class Allocator>
+arf_status decode(std::string_view utf8, basic_host_path<N, Allocator> &out) {
+    std::size_t size;
+    arf_status status = arf_decode(detail::bytes(utf8), utf8.size(), out.ptr_,
+                                   out.cap_, &size);
+    if (status == ARF_TOO_SMALL) {
+        char *ptr = out.reserve(size);
+        status = arf_decode(detail::bytes(utf8), utf8.size(), ptr, size, &size);
+    }
+    if (status == ARF_OK) {
+        out.size_ = size - 1;
+    } else {
+        out.ptr_[0] = '\0';
+        out.size_ = 0;
+    }
+    return status;
+}
+
+/// Like `decode`, but using `arf_decode_trusted`, for input known to be plain
+/// UTF-8 or a valid ARF string.
+template <std::size_t N, class Allocator>
+void decode_trusted(std::string_view utf8, basic_host_path<N, Allocator> &out) {
+    char *ptr = out.reserve(utf8.size() + 1);
+    out.size_ = arf_decode_trusted(detail::bytes(utf8), utf8.size(), ptr) - 1;
+}
+
+} // namespace arf
+
+/// The UTF-8 form of the host string literal `host`, computed at compile
+/// time, as an `arf::fixed_string`.
+#define ARF_LITERAL(host)                                                      \
+    (::arf::encode_fixed<::arf::detail::literal_encoded_size(                  \
+        ::std::string_view(host, sizeof(host) - 1))>(                          \
+        ::std::string_view(host, sizeof(host) - 1)))
+
+/// The host bytes of the UTF-8 or ARF string literal `utf8`, computed at
+/// compile time, as an `arf::fixed_string`. Invalid input is a compile-time
+/// error.
+#define ARF_HOST_LITERAL(utf8)                                                 \
+    (::arf::decode_fixed<::arf::detail::literal_decoded_size(                  \
+        ::std::string_view(utf8, sizeof(utf8) - 1))>(                          \
+        ::std::string_view(utf8, sizeof(utf8) - 1)))
+
+#endif
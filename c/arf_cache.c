@@ -0,0 +1,336 @@
+//! A sharded, fixed-budget cache of ARF conversions.
+
+#include "arf_cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Caches are split into at most 2^max_shard_bits shards, each with at least
+// min_shard_budget bytes, unless the whole budget is smaller than that.
+static const unsigned max_shard_bits = 6;
+static const size_t min_shard_budget = 64 * 1024;
+
+// The entry size the hash tables are sized for, which is about that of a
+// path of a few dozen bytes in both forms.
+static const size_t expected_entry_size = 256;
+
+struct cache_entry {
+    // The next entry in the same bucket.
+    struct cache_entry *next;
+    // The neighbours on the shard's clock.
+    struct cache_entry *prev_clock;
+    struct cache_entry *next_clock;
+    // `arf_hash_host` of the host string, which is `arf_hash` of the ARF
+    // string too, so lookups either way find the same entry.
+    uint64_t hash;
+    size_t host_len;
+    size_t arf_len;
+    // Whether the entry has been used since the clock hand last passed it.
+    bool referenced;
+    // The host string, followed by the ARF string.
+    uint8_t data[];
+};
+
+// Shards are aligned to cache lines so that threads using different shards
+// don't contend for them.
+struct arf_cache_shard {
+    pthread_mutex_t lock;
+    struct cache_entry **buckets;
+    size_t bucket_mask;
+    // The next entry to consider for eviction. New entries go just behind
+    // it, so they're considered last.
+    struct cache_entry *hand;
+    // Bytes used by the table and entries, and the most that may be.
+    size_t bytes;
+    size_t budget;
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+} __attribute__((__aligned__(64)));
+
+static size_t entry_size(const struct cache_entry *entry) {
+    return sizeof(*entry) + entry->host_len + entry->arf_len;
+}
+
+static struct arf_cache_shard *shard_for(struct arf_cache *cache,
+                                         uint64_t hash) {
+    // The table indexes by the low bits, so pick shards by the high ones.
+    if (cache->shard_bits == 0)
+        return cache->shards;
+    return &cache->shards[hash >> (64 - cache->shard_bits)];
+}
+
+bool arf_cache_init(struct arf_cache *cache, size_t budget) {
+    unsigned bits = 0;
+    while (bits < max_shard_bits && budget >> (bits + 1) >= min_shard_budget)
+        ++bits;
+    size_t count = (size_t)1 << bits;
+    size_t shard_budget = budget >> bits;
+    size_t buckets = 1;
+    while (buckets * 2 * expected_entry_size <= shard_budget)
+        buckets *= 2;
+
+    struct arf_cache_shard *shards = aligned_alloc(
+        _Alignof(struct arf_cache_shard), count * sizeof(*shards));
+    if (shards == NULL)
+        return false;
+    for (size_t i = 0; i != count; ++i) {
+        struct arf_cache_shard *shard = &shards[i];
+        memset(shard, 0, sizeof(*shard));
+        shard->buckets = calloc(buckets, sizeof(*shard->buckets));
+        if (shard->buckets == NULL) {
+            while (i-- != 0) {
+                pthread_mutex_destroy(&shards[i].lock);
+                free(shards[i].buckets);
+            }
+            free(shards);
+            return false;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_mask = buckets - 1;
+        shard->bytes = buckets * sizeof(*shard->buckets);
+        shard->budget = shard_budget;
+    }
+
+    cache->shards = shards;
+    cache->shard_bits = bits;
+    return true;
+}
+
+void arf_cache_destroy(struct arf_cache *cache) {
+    size_t count = (size_t)1 << cache->shard_bits;
+    for (size_t i = 0; i != count; ++i) {
+        struct arf_cache_shard *shard = &cache->shards[i];
+        struct cache_entry *entry = shard->hand;
+        for (size_t n = 0; n != shard->entries; ++n) {
+            struct cache_entry *next = entry->next_clock;
+            free(entry);
+            entry = next;
+        }
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->buckets);
+    }
+    free(cache->shards);
+    cache->shards = NULL;
+}
+
+// Find the entry for the host string `host`. The shard must be locked.
+static struct cache_entry *find_host(struct arf_cache_shard *shard,
+                                     uint64_t hash, const uint8_t *host,
+                                     size_t len) {
+    struct cache_entry *entry = shard->buckets[hash & shard->bucket_mask];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->host_len == len &&
+            memcmp(entry->data, host, len) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Find the entry for the ARF string `arf`. The shard must be locked.
+static struct cache_entry *find_arf(struct arf_cache_shard *shard,
+                                    uint64_t hash, const uint8_t *arf,
+                                    size_t len) {
+    struct cache_entry *entry = shard->buckets[hash & shard->bucket_mask];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->arf_len == len &&
+            memcmp(entry->data + entry->host_len, arf, len) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Take the next unreferenced entry off the clock and out of the table,
+// clearing the references of those passed over, and return it. The shard
+// must be locked and not empty.
+static struct cache_entry *evict(struct arf_cache_shard *shard) {
+    struct cache_entry *entry;
+    for (;;) {
+        entry = shard->hand;
+        shard->hand = entry->next_clock;
+        if (!entry->referenced)
+            break;
+        entry->referenced = false;
+    }
+
+    if (entry->next_clock == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->prev_clock->next_clock = entry->next_clock;
+        entry->next_clock->prev_clock = entry->prev_clock;
+    }
+    struct cache_entry **link =
+        &shard->buckets[entry->hash & shard->bucket_mask];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    shard->bytes -= entry_size(entry);
+    shard->entries -= 1;
+    shard->evictions += 1;
+    return entry;
+}
+
+// Add an entry for a host string and its ARF string, evicting others to make
+// room, unless it's already there or is too big to fit at all. If `arf` is
+// NULL, the entry's ARF string is encoded from `host`, and is `arf_len` bytes.
+static void insert(struct arf_cache_shard *shard, uint64_t hash,
+                   const uint8_t *host, size_t host_len, const uint8_t *arf,
+                   size_t arf_len) {
+    size_t table = (shard->bucket_mask + 1) * sizeof(*shard->buckets);
+    size_t size = sizeof(struct cache_entry) + host_len + arf_len;
+    if (table >= shard->budget || host_len > shard->budget ||
+        arf_len > shard->budget || size > shard->budget - table)
+        return;
+
+    // Fill in the entry before locking, to keep the lock held briefly.
+    struct cache_entry *entry = malloc(size);
+    if (entry == NULL)
+        return;
+    entry->hash = hash;
+    entry->host_len = host_len;
+    entry->arf_len = arf_len;
+    entry->referenced = false;
+    memcpy(entry->data, host, host_len);
+    if (arf != NULL)
+        memcpy(entry->data + host_len, arf, arf_len);
+    else
+        arf_encode(host, host_len, entry->data + host_len, arf_len);
+
+    struct cache_entry *evicted = NULL;
+    pthread_mutex_lock(&shard->lock);
+
+    // Another thread may have added it since we looked.
+    if (find_host(shard, hash, host, host_len) != NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        free(entry);
+        return;
+    }
+
+    // Evicted entries are chained through `next`, to be freed unlocked.
+    while (shard->budget - shard->bytes < size) {
+        struct cache_entry *victim = evict(shard);
+        victim->next = evicted;
+        evicted = victim;
+    }
+
+    struct cache_entry **bucket = &shard->buckets[hash & shard->bucket_mask];
+    entry->next = *bucket;
+    *bucket = entry;
+    if (shard->hand == NULL) {
+        entry->prev_clock = entry;
+        entry->next_clock = entry;
+        shard->hand = entry;
+    } else {
+        entry->next_clock = shard->hand;
+        entry->prev_clock = shard->hand->prev_clock;
+        entry->prev_clock->next_clock = entry;
+        shard->hand->prev_clock = entry;
+    }
+    shard->bytes += size;
+    shard->entries += 1;
+    shard->insertions += 1;
+    pthread_mutex_unlock(&shard->lock);
+
+    while (evicted != NULL) {
+        struct cache_entry *next = evicted->next;
+        free(evicted);
+        evicted = next;
+    }
+}
+
+size_t arf_cache_encode(struct arf_cache *cache, const uint8_t *in,
+                        size_t len, uint8_t *out, size_t cap) {
+    // Valid UTF-8 is its own encoding, and isn't cached.
+    if (__builtin_expect(arf_utf8_valid_up_to(in, len) == len, true)) {
+        if (len <= cap && len != 0)
+            memcpy(out, in, len);
+        return len;
+    }
+
+    uint64_t hash = arf_hash_host(0, in, len);
+    struct arf_cache_shard *shard = shard_for(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+    struct cache_entry *entry = find_host(shard, hash, in, len);
+    if (entry != NULL) {
+        size_t size = entry->arf_len;
+        if (size <= cap)
+            memcpy(out, entry->data + entry->host_len, size);
+        entry->referenced = true;
+        shard->hits += 1;
+        pthread_mutex_unlock(&shard->lock);
+        return size;
+    }
+    shard->misses += 1;
+    pthread_mutex_unlock(&shard->lock);
+
+    size_t size = arf_encode(in, len, out, cap);
+    if (size <= cap)
+        insert(shard, hash, in, len, out, size);
+    return size;
+}
+
+enum arf_status arf_cache_decode(struct arf_cache *cache, const uint8_t *ptr,
+                                 size_t len, char *c_str, size_t cap,
+                                 size_t *size) {
+    // Only ARF strings are cached, and they start with a BOM and contain a
+    // NUL. Anything else is decoded as it would be without the cache.
+    const size_t bom_len = 3;
+    if (__builtin_expect(!arf_has_arf_magic(ptr, len), true) ||
+        memchr(ptr + bom_len, '\0', len - bom_len) == NULL)
+    {
+        return arf_decode(ptr, len, c_str, cap, size);
+    }
+
+    uint64_t hash = arf_hash(0, ptr, len);
+    struct arf_cache_shard *shard = shard_for(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+    struct cache_entry *entry = find_arf(shard, hash, ptr, len);
+    if (entry != NULL) {
+        size_t host_len = entry->host_len;
+        *size = host_len + 1;
+        if (host_len < cap) {
+            memcpy(c_str, entry->data, host_len);
+            c_str[host_len] = '\0';
+        }
+        entry->referenced = true;
+        shard->hits += 1;
+        pthread_mutex_unlock(&shard->lock);
+        return host_len < cap ? ARF_OK : ARF_TOO_SMALL;
+    }
+    shard->misses += 1;
+    pthread_mutex_unlock(&shard->lock);
+
+    // Valid ARF strings may escape bytes which needn't be, and caching one of
+    // those would make encoding return it, so cache the canonical encoding.
+    // That may turn out to be the host string itself, if it's plain UTF-8,
+    // which isn't cached.
+    enum arf_status status = arf_decode(ptr, len, c_str, cap, size);
+    if (status == ARF_OK) {
+        const uint8_t *host = (const uint8_t *)c_str;
+        size_t host_len = *size - 1;
+        size_t arf_len = arf_encode(host, host_len, NULL, 0);
+        if (arf_len != host_len && arf_len != SIZE_MAX)
+            insert(shard, hash, host, host_len, NULL, arf_len);
+    }
+    return status;
+}
+
+void arf_cache_get_stats(struct arf_cache *cache,
+                         struct arf_cache_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    size_t count = (size_t)1 << cache->shard_bits;
+    for (size_t i = 0; i != count; ++i) {
+        struct arf_cache_shard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->insertions += shard->insertions;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->entries;
+        stats->bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
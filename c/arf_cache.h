@@ -0,0 +1,73 @@
+#ifndef ARF_CACHE_H
+#define ARF_CACHE_H
+
+#include "arf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// A cache of conversions between host strings which need ARF encoding and
+/// their ARF strings, for programs which convert the same few paths over and
+/// over. Each entry holds both forms, so it serves conversions either way.
+/// Plain UTF-8 is never cached, and converting it costs what `arf_encode` and
+/// `arf_decode` do.
+///
+/// The cache is safe to use from many threads at once. It's split into
+/// shards by hash, each with its own lock, so threads converting different
+/// strings rarely wait for each other. Each shard evicts with the CLOCK
+/// algorithm when a new entry would take it over its share of the budget.
+struct arf_cache {
+    struct arf_cache_shard *shards;
+    unsigned shard_bits;
+};
+
+/// Counts of the cache's activity, summed over its shards.
+struct arf_cache_stats {
+    /// Conversions answered from the cache.
+    uint64_t hits;
+    /// Conversions of strings needing ARF encoding which weren't cached.
+    uint64_t misses;
+    /// Entries added.
+    uint64_t insertions;
+    /// Entries evicted to make room for others.
+    uint64_t evictions;
+    /// Entries now held.
+    size_t entries;
+    /// Bytes now used by entries and tables.
+    size_t bytes;
+};
+
+/// Initialize a cache which uses at most `budget` bytes for its entries and
+/// tables, not counting the allocator's own overhead. A budget too small for
+/// the tables caches nothing. Returns false if memory allocation fails.
+bool arf_cache_init(struct arf_cache *cache, size_t budget)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Free the cache's memory. No other thread may be using it.
+void arf_cache_destroy(struct arf_cache *cache)
+    __attribute__((__nonnull__(1), __nothrow__));
+
+/// Like `arf_encode`, but look up host strings which need ARF encoding in the
+/// cache first, and add the ARF strings it encodes in full.
+size_t arf_cache_encode(struct arf_cache *cache, const uint8_t *in,
+                        size_t len, uint8_t *__restrict__ out, size_t cap)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+/// Like `arf_decode`, but look up ARF strings in the cache first, and add the
+/// ones it decodes in full.
+enum arf_status arf_cache_decode(struct arf_cache *cache, const uint8_t *ptr,
+                                 size_t len, char *__restrict__ c_str,
+                                 size_t cap, size_t *__restrict__ size)
+    __attribute__((__nonnull__(1, 2, 6), __nothrow__));
+
+/// Store the cache's counts in *stats.
+void arf_cache_get_stats(struct arf_cache *cache,
+                         struct arf_cache_stats *stats)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+//! ARF-aware directory reading for Linux.
+
+#define _GNU_SOURCE
+#include "arf_dir.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Offsets of the fields of a `struct linux_dirent64`. They're read with
+// `memcpy`, so that the caller's buffer needn't be aligned.
+enum {
+    DIRENT_INO = 0,
+    DIRENT_RECLEN = 16,
+    DIRENT_TYPE = 18,
+    DIRENT_NAME = 19,
+};
+
+void arf_dir_init(struct arf_dir *dir, int fd, void *buf, size_t cap) {
+    dir->fd = fd;
+    dir->buf = buf;
+    dir->cap = cap;
+    dir->pos = 0;
+    dir->end = 0;
+}
+
+int arf_dir_next(struct arf_dir *dir, struct arf_dirent *ent) {
+    if (dir->pos == dir->end) {
+        long n = syscall(SYS_getdents64, dir->fd, dir->buf, dir->cap);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return 0;
+        dir->pos = 0;
+        dir->end = (size_t)n;
+    }
+
+    const uint8_t *rec = dir->buf + dir->pos;
+    uint16_t reclen;
+    memcpy(&ent->ino, rec + DIRENT_INO, sizeof(ent->ino));
+    memcpy(&reclen, rec + DIRENT_RECLEN, sizeof(reclen));
+    ent->type = rec[DIRENT_TYPE];
+    dir->pos += reclen;
+
+    // The name is NUL-terminated, and padded out to the end of the record.
+    const uint8_t *name = rec + DIRENT_NAME;
+    size_t len = strnlen((const char *)name, reclen - DIRENT_NAME);
+
+    // Valid UTF-8 is by far the common case, so check for it without
+    // writing anything, and point at the record. Encode only the rest, once,
+    // into `dir->name`, which has room for the ARF string of any name.
+    if (__builtin_expect(arf_utf8_valid_up_to(name, len) == len, true)) {
+        ent->arf = false;
+        ent->name = name;
+        ent->name_len = len;
+        return 1;
+    }
+
+    size_t size = arf_encode(name, len, dir->name, sizeof(dir->name));
+    if (size > sizeof(dir->name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    ent->arf = true;
+    ent->name = dir->name;
+    ent->name_len = size;
+    return 1;
+}
+
+#endif
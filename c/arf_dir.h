@@ -0,0 +1,60 @@
+#ifndef ARF_DIR_H
+#define ARF_DIR_H
+
+#include "arf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// The largest ARF string a directory entry name can need: a `NAME_MAX`-byte
+/// name where every byte is invalid.
+#define ARF_DIR_NAME_MAX (4 + 5 * 255)
+
+/// A directory entry returned by `arf_dir_next`.
+struct arf_dirent {
+    /// The inode number.
+    uint64_t ino;
+    /// The file type, as one of the `DT_*` constants.
+    unsigned char type;
+    /// Whether `name` is an ARF string rather than plain UTF-8.
+    bool arf;
+    /// The name. Plain UTF-8 names point into the caller's buffer and are
+    /// NUL-terminated; ARF names point into the `arf_dir` and, since they
+    /// contain a NUL, are not. Either way it's valid until the next call to
+    /// `arf_dir_next`.
+    const uint8_t *name;
+    /// The length of `name` in bytes.
+    size_t name_len;
+};
+
+/// An iterator over the entries of a directory, which reads them in large
+/// batches with `getdents64` and presents each name as UTF-8. Names which
+/// are already valid UTF-8 are returned in place; only the others are
+/// encoded, into storage inside the iterator, so no allocation is done.
+struct arf_dir {
+    int fd;
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;
+    size_t end;
+    uint8_t name[ARF_DIR_NAME_MAX];
+};
+
+/// Initialize an iterator reading from the open directory `fd`, using the
+/// `cap` bytes at `buf` to hold batches of entries. Bigger buffers mean fewer
+/// system calls; 64 KiB or more is a good choice for big directories. The
+/// iterator doesn't take ownership of `fd` or `buf`.
+void arf_dir_init(struct arf_dir *dir, int fd, void *buf, size_t cap)
+    __attribute__((__nonnull__(1, 3), __nothrow__));
+
+/// Read the next entry. Return 1 and fill in `ent` if there is one, 0 at the
+/// end of the directory, or -1 with `errno` set on failure.
+int arf_dir_next(struct arf_dir *dir, struct arf_dirent *ent)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ARF_INLINE_H
+#define ARF_INLINE_H
+
+/// The whole library, compiled into the including file as `static inline`
+/// functions, so that the compiler can inline the conversions into their
+/// callers and specialize them for constant arguments. Include this instead
+/// of `arf.h`, from C, and don't link against the library. Each file which
+/// includes it gets its own copy of anything it uses, including its own
+/// `arf_stats` counters when built with `ARF_STATS`.
+
+#ifdef ARF_H
+#error "include arf_inline.h instead of arf.h, not after it"
+#endif
+
+#define ARF_API static inline
+#include "arf.c"
+
+#endif
@@ -0,0 +1,324 @@
+//! An interposition library which lets unmodified programs use ARF paths.
+//!
+//! Build with CMake (`cmake --build . --target arf_preload`), or with:
+//!
+//!     cc -O2 -shared -fPIC -fno-delete-null-pointer-checks -o libarf_preload.so
+//!         arf_preload.c -ldl
+//!
+//! (`-fno-delete-null-pointer-checks` keeps the NULL checks, which libc's
+//! declarations would otherwise let the compiler assume away.)
+//!
+//! and run programs as:
+//!
+//!     LD_PRELOAD=/path/to/libarf_preload.so program ...
+//!
+//! or link them against it, ahead of libc, with `ARF_PRELOAD_READ_PAST_NUL=1`
+//! in the environment. Each interposed function checks its path arguments for
+//! a leading BOM, which costs a load and a compare for plain paths, and
+//! decodes ARF paths into thread-local buffers, so no call allocates.
+//!
+//! Finding an ARF string's NUL-escaped portion means reading past the NUL
+//! which ends the path as C sees it, and for a plain path which merely starts
+//! with a BOM and contains U+FFFD, those bytes aren't part of it. They may be
+//! unmapped, or may happen to look like an escaped portion, which would make
+//! the call use a different path. So the interposed functions pass every path
+//! on unchanged unless the environment variable opts in to that risk.
+//!
+//! The library is compiled in through `arf_inline.h`, so the decoding is
+//! inlined into the shims, and the shim exports no `arf_` functions of its
+//! own beyond `arf_preload_host_path` and `arf_preload_host_path_len`.
+
+#define _GNU_SOURCE
+#undef _FORTIFY_SOURCE
+#include "arf_inline.h"
+#include "arf_preload.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Whether `path` starts with a BOM, and so might be an ARF string. This is
+// all the work done for plain paths.
+static inline bool maybe_arf(const char *path) {
+    return path != NULL && __builtin_expect((uint8_t)path[0] == 0xef, false) &&
+           (uint8_t)path[1] == 0xbb && (uint8_t)path[2] == 0xbf;
+}
+
+// Return the length of the ARF string starting at `ptr`, assuming it is one,
+// or zero if it can't be because the lossy portion has no U+FFFD. Every
+// character of the lossy portion corresponds to the same bytes in the
+// NUL-escaped portion, except that a U+FFFD may instead correspond to an
+// escape, so this only looks at the NUL-escaped portion where a valid ARF
+// string would have one of those.
+static size_t arf_extent(const uint8_t *ptr) {
+    const uint8_t *lossy = ptr + 3;
+    size_t lossy_len = strlen((const char *)lossy);
+    const uint8_t *escaped = lossy + lossy_len + 1;
+    bool any_replacement = false;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < lossy_len;) {
+        if (lossy[i] == 0xef && lossy_len - i >= 3 && lossy[i + 1] == 0xbf &&
+            lossy[i + 2] == 0xbd)
+        {
+            any_replacement = true;
+            pos += escaped[pos] == '\0' ? 2 : 3;
+            i += 3;
+        } else {
+            pos += 1;
+            i += 1;
+        }
+    }
+
+    return any_replacement ? 3 + lossy_len + 1 + pos : 0;
+}
+
+const char *arf_preload_host_path_len(const char *path, size_t len, char *buf,
+                                      size_t cap) {
+    const uint8_t *ptr = (const uint8_t *)path;
+    // Without a NUL, it's plain UTF-8 or not UTF-8 at all, and either way it's
+    // a path to pass on as it is.
+    if (!arf_has_arf_magic(ptr, len) || memchr(ptr, '\0', len) == NULL)
+        return path;
+
+    size_t size;
+    switch (arf_decode(ptr, len, buf, cap, &size)) {
+    case ARF_OK:
+        return buf;
+    case ARF_TOO_SMALL:
+        errno = ENAMETOOLONG;
+        return NULL;
+    default:
+        // Not an ARF string after all, just a path which looks like one.
+        return path;
+    }
+}
+
+const char *arf_preload_host_path(const char *path, char *buf, size_t cap) {
+    if (!maybe_arf(path))
+        return path;
+
+    size_t len = arf_extent((const uint8_t *)path);
+    if (len == 0)
+        return path;
+    return arf_preload_host_path_len(path, len, buf, cap);
+}
+
+// Whether the environment opts in to reading past the ends of paths. This is
+// only asked about paths which start with a BOM, so plain paths don't pay for
+// it, and it's asked each time, so that tests can change it.
+static bool read_past_nul(void) {
+    const char *value = getenv("ARF_PRELOAD_READ_PAST_NUL");
+    return value != NULL && strcmp(value, "1") == 0;
+}
+
+// Space for the decoded paths of the current call, which has at most two.
+static __thread char buffers[2][PATH_MAX];
+
+// Decode `path`, the `i`th path argument of the current call, if it's an ARF
+// string, or return `fail` if it doesn't fit.
+#define HOST_PATH(path, i, fail)                                               \
+    if (__builtin_expect(maybe_arf(path), false) && read_past_nul()) {         \
+        path = arf_preload_host_path(path, buffers[i], PATH_MAX);              \
+        if (path == NULL)                                                      \
+            return fail;                                                       \
+    }
+
+// Declare `real` as the next definition of `name`, normally libc's, looking
+// it up on first use.
+#define REAL(name)                                                             \
+    static __typeof__(name) *real_##name;                                      \
+    __typeof__(name) *real = __atomic_load_n(&real_##name, __ATOMIC_RELAXED);  \
+    if (__builtin_expect(real == NULL, false)) {                               \
+        real = (__typeof__(name) *)dlsym(RTLD_NEXT, #name);                    \
+        __atomic_store_n(&real_##name, real, __ATOMIC_RELAXED);                \
+    }
+
+// Wrappers for functions taking one path, `path`.
+#define WRAP_PATH(ret, name, fail, params, args)                               \
+    ret name params {                                                          \
+        REAL(name)                                                             \
+        HOST_PATH(path, 0, fail)                                               \
+        return real args;                                                      \
+    }
+
+// Wrappers for functions taking two paths, `old_path` and `new_path`.
+#define WRAP_PATHS(ret, name, fail, params, args)                              \
+    ret name params {                                                          \
+        REAL(name)                                                             \
+        HOST_PATH(old_path, 0, fail)                                           \
+        HOST_PATH(new_path, 1, fail)                                           \
+        return real args;                                                      \
+    }
+
+// Whether `open` and friends take a mode argument with these flags.
+static inline bool needs_mode(int flags) {
+    return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+#define WRAP_OPEN(name)                                                        \
+    int name(const char *path, int flags, ...) {                               \
+        REAL(name)                                                             \
+        mode_t mode = 0;                                                       \
+        if (needs_mode(flags)) {                                               \
+            va_list ap;                                                        \
+            va_start(ap, flags);                                               \
+            mode = va_arg(ap, mode_t);                                         \
+            va_end(ap);                                                        \
+        }                                                                      \
+        HOST_PATH(path, 0, -1)                                                 \
+        return real(path, flags, mode);                                        \
+    }
+
+#define WRAP_OPENAT(name)                                                      \
+    int name(int dirfd, const char *path, int flags, ...) {                    \
+        REAL(name)                                                             \
+        mode_t mode = 0;                                                       \
+        if (needs_mode(flags)) {                                               \
+            va_list ap;                                                        \
+            va_start(ap, flags);                                               \
+            mode = va_arg(ap, mode_t);                                         \
+            va_end(ap);                                                        \
+        }                                                                      \
+        HOST_PATH(path, 0, -1)                                                 \
+        return real(dirfd, path, flags, mode);                                 \
+    }
+
+WRAP_OPEN(open)
+WRAP_OPEN(open64)
+WRAP_OPENAT(openat)
+WRAP_OPENAT(openat64)
+WRAP_PATH(int, creat, -1, (const char *path, mode_t mode), (path, mode))
+WRAP_PATH(int, creat64, -1, (const char *path, mode_t mode), (path, mode))
+WRAP_PATH(FILE *, fopen, NULL, (const char *path, const char *mode),
+          (path, mode))
+WRAP_PATH(FILE *, fopen64, NULL, (const char *path, const char *mode),
+          (path, mode))
+WRAP_PATH(FILE *, freopen, NULL,
+          (const char *path, const char *mode, FILE *stream),
+          (path, mode, stream))
+WRAP_PATH(FILE *, freopen64, NULL,
+          (const char *path, const char *mode, FILE *stream),
+          (path, mode, stream))
+WRAP_PATH(DIR *, opendir, NULL, (const char *path), (path))
+
+WRAP_PATH(int, stat, -1, (const char *path, struct stat *buf), (path, buf))
+WRAP_PATH(int, stat64, -1, (const char *path, struct stat64 *buf),
+          (path, buf))
+WRAP_PATH(int, lstat, -1, (const char *path, struct stat *buf), (path, buf))
+WRAP_PATH(int, lstat64, -1, (const char *path, struct stat64 *buf),
+          (path, buf))
+WRAP_PATH(int, fstatat, -1,
+          (int dirfd, const char *path, struct stat *buf, int flags),
+          (dirfd, path, buf, flags))
+WRAP_PATH(int, fstatat64, -1,
+          (int dirfd, const char *path, struct stat64 *buf, int flags),
+          (dirfd, path, buf, flags))
+WRAP_PATH(int, statx, -1,
+          (int dirfd, const char *path, int flags, unsigned int mask,
+           struct statx *buf),
+          (dirfd, path, flags, mask, buf))
+
+// Programs built against glibc before 2.33 call these instead of `stat` and
+// friends.
+int __xstat(int ver, const char *path, struct stat *buf);
+int __xstat64(int ver, const char *path, struct stat64 *buf);
+int __lxstat(int ver, const char *path, struct stat *buf);
+int __lxstat64(int ver, const char *path, struct stat64 *buf);
+int __fxstatat(int ver, int dirfd, const char *path, struct stat *buf,
+               int flags);
+int __fxstatat64(int ver, int dirfd, const char *path, struct stat64 *buf,
+                 int flags);
+WRAP_PATH(int, __xstat, -1, (int ver, const char *path, struct stat *buf),
+          (ver, path, buf))
+WRAP_PATH(int, __xstat64, -1, (int ver, const char *path, struct stat64 *buf),
+          (ver, path, buf))
+WRAP_PATH(int, __lxstat, -1, (int ver, const char *path, struct stat *buf),
+          (ver, path, buf))
+WRAP_PATH(int, __lxstat64, -1,
+          (int ver, const char *path, struct stat64 *buf), (ver, path, buf))
+WRAP_PATH(int, __fxstatat, -1,
+          (int ver, int dirfd, const char *path, struct stat *buf, int flags),
+          (ver, dirfd, path, buf, flags))
+WRAP_PATH(int, __fxstatat64, -1,
+          (int ver, int dirfd, const char *path, struct stat64 *buf, int flags),
+          (ver, dirfd, path, buf, flags))
+
+WRAP_PATH(int, access, -1, (const char *path, int mode), (path, mode))
+WRAP_PATH(int, faccessat, -1,
+          (int dirfd, const char *path, int mode, int flags),
+          (dirfd, path, mode, flags))
+WRAP_PATH(int, chdir, -1, (const char *path), (path))
+WRAP_PATH(int, chmod, -1, (const char *path, mode_t mode), (path, mode))
+WRAP_PATH(int, fchmodat, -1,
+          (int dirfd, const char *path, mode_t mode, int flags),
+          (dirfd, path, mode, flags))
+WRAP_PATH(int, chown, -1, (const char *path, uid_t owner, gid_t group),
+          (path, owner, group))
+WRAP_PATH(int, lchown, -1, (const char *path, uid_t owner, gid_t group),
+          (path, owner, group))
+WRAP_PATH(int, fchownat, -1,
+          (int dirfd, const char *path, uid_t owner, gid_t group, int flags),
+          (dirfd, path, owner, group, flags))
+WRAP_PATH(int, truncate, -1, (const char *path, off_t length), (path, length))
+WRAP_PATH(int, truncate64, -1, (const char *path, off64_t length),
+          (path, length))
+WRAP_PATH(int, utimes, -1, (const char *path, const struct timeval times[2]),
+          (path, times))
+WRAP_PATH(int, utimensat, -1,
+          (int dirfd, const char *path, const struct timespec times[2],
+           int flags),
+          (dirfd, path, times, flags))
+WRAP_PATH(ssize_t, readlink, -1, (const char *path, char *buf, size_t size),
+          (path, buf, size))
+WRAP_PATH(ssize_t, readlinkat, -1,
+          (int dirfd, const char *path, char *buf, size_t size),
+          (dirfd, path, buf, size))
+WRAP_PATH(char *, realpath, NULL, (const char *path, char *resolved),
+          (path, resolved))
+
+WRAP_PATH(int, mkdir, -1, (const char *path, mode_t mode), (path, mode))
+WRAP_PATH(int, mkdirat, -1, (int dirfd, const char *path, mode_t mode),
+          (dirfd, path, mode))
+WRAP_PATH(int, mkfifo, -1, (const char *path, mode_t mode), (path, mode))
+WRAP_PATH(int, mknod, -1, (const char *path, mode_t mode, dev_t dev),
+          (path, mode, dev))
+WRAP_PATH(int, mknodat, -1,
+          (int dirfd, const char *path, mode_t mode, dev_t dev),
+          (dirfd, path, mode, dev))
+WRAP_PATH(int, rmdir, -1, (const char *path), (path))
+WRAP_PATH(int, unlink, -1, (const char *path), (path))
+WRAP_PATH(int, unlinkat, -1, (int dirfd, const char *path, int flags),
+          (dirfd, path, flags))
+
+WRAP_PATHS(int, rename, -1, (const char *old_path, const char *new_path),
+           (old_path, new_path))
+WRAP_PATHS(int, renameat, -1,
+           (int old_dirfd, const char *old_path, int new_dirfd,
+            const char *new_path),
+           (old_dirfd, old_path, new_dirfd, new_path))
+WRAP_PATHS(int, renameat2, -1,
+           (int old_dirfd, const char *old_path, int new_dirfd,
+            const char *new_path, unsigned int flags),
+           (old_dirfd, old_path, new_dirfd, new_path, flags))
+WRAP_PATHS(int, link, -1, (const char *old_path, const char *new_path),
+           (old_path, new_path))
+WRAP_PATHS(int, linkat, -1,
+           (int old_dirfd, const char *old_path, int new_dirfd,
+            const char *new_path, int flags),
+           (old_dirfd, old_path, new_dirfd, new_path, flags))
+// A symlink's target is a path too, so it's decoded along with the link's.
+WRAP_PATHS(int, symlink, -1, (const char *old_path, const char *new_path),
+           (old_path, new_path))
+WRAP_PATHS(int, symlinkat, -1,
+           (const char *old_path, int new_dirfd, const char *new_path),
+           (old_path, new_dirfd, new_path))
@@ -0,0 +1,42 @@
+#ifndef ARF_PRELOAD_H
+#define ARF_PRELOAD_H
+
+#include "arf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// If the `len` bytes at `path` are an ARF string, decode it into the `cap`
+/// bytes at `buf` and return `buf`. Otherwise, return `path` itself. Returns
+/// NULL and sets errno to `ENAMETOOLONG` if the decoded path doesn't fit.
+/// Callers which know where the path ends should use this.
+const char *arf_preload_host_path_len(const char *path, size_t len, char *buf,
+                                      size_t cap)
+    __attribute__((__nonnull__(1, 3), __nothrow__));
+
+/// Like `arf_preload_host_path_len`, for a path whose length isn't known.
+///
+/// WARNING: this reads past the NUL which terminates `path` whenever `path`
+/// starts with a BOM and contains U+FFFD, because that's where an ARF
+/// string's NUL-escaped portion would be. A plain path may look like that,
+/// and then those bytes belong to something else. Reading them may fault,
+/// and if they happen to look like an escaped portion, the result is a
+/// different path. Only use this where every such path is known to be an
+/// ARF string held in memory in full.
+///
+/// This is what the functions interposed by `libarf_preload.so` use, which
+/// let unmodified programs open ARF paths. Because of the hazard above, they
+/// only do so when the environment variable `ARF_PRELOAD_READ_PAST_NUL` is
+/// `1`, and pass paths on unchanged otherwise. Load it with `LD_PRELOAD`, or
+/// link it ahead of libc, and `open`, `stat`, `rename`, `unlink`, and similar
+/// calls decode ARF paths into a thread-local `PATH_MAX` buffer before
+/// passing them on. Plain paths are passed on as they are.
+const char *arf_preload_host_path(const char *path, char *buf, size_t cap)
+    __attribute__((__nonnull__(1, 2), __nothrow__));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,818 @@
+//! Benchmarks for every public function in arf.h, run against generated
+//! corpora of paths.
+//!
+//! Build with CMake (`cmake --build . --target arf_bench`), or with:
+//!
+//!     cc -O2 -I.. bench.c ../arf.c -o bench
+//!
+//! and run as:
+//!
+//!     ./bench [--json] [--time SECONDS] [FILTER]
+//!
+//! Each result is reported in nanoseconds per string and gigabytes per second
+//! of input. `--json` prints one JSON object per result instead of a table,
+//! for keeping historical comparisons. `FILTER` limits the run to results
+//! whose `function/corpus` name contains it.
+
+#define _GNU_SOURCE
+#include "arf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The approximate number of input bytes in each corpus.
+static const size_t corpus_bytes = 4 << 20;
+
+struct corpus {
+    const char *name;
+    // The host strings, NULL-terminated.
+    char **c_strs;
+    size_t *lens;
+    size_t count;
+    size_t bytes;
+    // The UTF-8 form of each string: the string itself, or its ARF string.
+    uint8_t **utf8s;
+    size_t *utf8_lens;
+    // The indices of the strings whose UTF-8 forms are ARF strings.
+    size_t *arf_indices;
+    size_t arf_count;
+    size_t arf_bytes;
+    // The size of the largest UTF-8 form.
+    size_t max_utf8_len;
+    // The UTF-16 form of each string, as a Windows host would have it. The
+    // non-ASCII bytes of invalid strings become unpaired low surrogates.
+    uint16_t **utf16s;
+    size_t *utf16_lens;
+    // The Windows-scheme UTF-8 form of each string.
+    uint8_t **wutf8s;
+    size_t *wutf8_lens;
+    size_t wutf8_bytes;
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+// xorshift64*, which is plenty for generating test data.
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1d;
+}
+
+static size_t rng_range(size_t lo, size_t hi) {
+    return lo + (size_t)(rng() % (hi - lo + 1));
+}
+
+static size_t put_utf8(char *out, uint32_t c) {
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = (char)(0xc0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3f));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = (char)(0xe0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (c & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (c & 0x3f));
+    return 4;
+}
+
+static size_t put_ascii_name(char *out, size_t len) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_-.";
+    for (size_t i = 0; i != len; ++i)
+        out[i] = chars[rng() % (sizeof(chars) - 1)];
+    return len;
+}
+
+static size_t gen_ascii(char *out) {
+    size_t len = 0;
+    for (size_t n = rng_range(3, 8); n != 0; --n) {
+        out[len++] = '/';
+        len += put_ascii_name(out + len, rng_range(3, 12));
+    }
+    return len;
+}
+
+static size_t gen_cjk(char *out) {
+    size_t len = 0;
+    for (size_t n = rng_range(3, 8); n != 0; --n) {
+        out[len++] = '/';
+        for (size_t m = rng_range(2, 8); m != 0; --m) {
+            uint64_t r = rng() % 8;
+            if (r < 5)
+                len += put_utf8(out + len, (uint32_t)rng_range(0x4e00, 0x9fff));
+            else if (r < 6)
+                len += put_utf8(out + len, (uint32_t)rng_range(0x1f300, 0x1f64f));
+            else
+                len += put_ascii_name(out + len, 1);
+        }
+    }
+    return len;
+}
+
+static size_t gen_sparse_invalid(char *out) {
+    size_t len = gen_ascii(out);
+    out[rng_range(1, len - 1)] = (char)rng_range(0x80, 0xff);
+    return len;
+}
+
+static size_t gen_dense_invalid(char *out) {
+    size_t len = 0;
+    for (size_t n = rng_range(3, 8); n != 0; --n) {
+        out[len++] = '/';
+        for (size_t m = rng_range(3, 12); m != 0; --m)
+            out[len++] = rng() % 2 ? (char)rng_range(0x80, 0xff)
+                                   : (char)rng_range('a', 'z');
+    }
+    return len;
+}
+
+// Paths from a system with Latin-1 file names, where every accented letter
+// is an invalid byte.
+static size_t gen_latin1(char *out) {
+    size_t len = 0;
+    for (size_t n = rng_range(3, 8); n != 0; --n) {
+        out[len++] = '/';
+        for (size_t m = rng_range(3, 12); m != 0; --m) {
+            if (rng() % 6 == 0)
+                out[len++] = (char)rng_range(0xc0, 0xff);
+            else
+                len += put_ascii_name(out + len, 1);
+        }
+    }
+    return len;
+}
+
+static size_t gen_long(char *out) {
+    size_t len = 0;
+    while (len < 4000) {
+        out[len++] = '/';
+        if (rng() % 16 == 0)
+            len += put_utf8(out + len, (uint32_t)rng_range(0xc0, 0x17f));
+        len += put_ascii_name(out + len, rng_range(3, 20));
+    }
+    return len;
+}
+
+// Directory entry names, most of them short and ASCII, some with other
+// scripts, and a few in legacy 8-bit encodings.
+static size_t gen_dirnames(char *out) {
+    size_t len = put_ascii_name(out, rng_range(1, 6) + rng_range(0, 6) * rng_range(0, 3));
+    uint64_t r = rng() % 1000;
+    if (r < 80) {
+        len += put_utf8(out + len, (uint32_t)rng_range(0xc0, 0x17f));
+        len += put_ascii_name(out + len, rng_range(0, 6));
+    } else if (r < 100) {
+        len += put_utf8(out + len, (uint32_t)rng_range(0x4e00, 0x9fff));
+        len += put_utf8(out + len, (uint32_t)rng_range(0x4e00, 0x9fff));
+    } else if (r < 105) {
+        out[len++] = (char)rng_range(0xc0, 0xff);
+        len += put_ascii_name(out + len, rng_range(0, 6));
+    }
+    return len;
+}
+
+static void make_corpus(struct corpus *c, const char *name,
+                        size_t (*gen)(char *)) {
+    char buf[8192];
+    size_t cap = 1024;
+
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->c_strs = malloc(cap * sizeof(char *));
+    c->lens = malloc(cap * sizeof(size_t));
+    while (c->bytes < corpus_bytes) {
+        if (c->count + 1 == cap) {
+            cap *= 2;
+            c->c_strs = realloc(c->c_strs, cap * sizeof(char *));
+            c->lens = realloc(c->lens, cap * sizeof(size_t));
+        }
+        size_t len = gen(buf);
+        buf[len] = '\0';
+        c->c_strs[c->count] = strdup(buf);
+        c->lens[c->count] = len;
+        c->bytes += len;
+        c->count += 1;
+    }
+    c->c_strs[c->count] = NULL;
+
+    c->utf8s = malloc(c->count * sizeof(uint8_t *));
+    c->utf8_lens = malloc(c->count * sizeof(size_t));
+    c->arf_indices = malloc(c->count * sizeof(size_t));
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t size = arf_encode((const uint8_t *)c->c_strs[i], c->lens[i],
+                                 NULL, 0);
+        c->utf8s[i] = malloc(size + 1);
+        arf_encode((const uint8_t *)c->c_strs[i], c->lens[i], c->utf8s[i], size);
+        c->utf8_lens[i] = size;
+        if (size > c->max_utf8_len)
+            c->max_utf8_len = size;
+        if (size != c->lens[i]) {
+            c->arf_indices[c->arf_count++] = i;
+            c->arf_bytes += size;
+        }
+    }
+
+    c->utf16s = malloc(c->count * sizeof(uint16_t *));
+    c->utf16_lens = malloc(c->count * sizeof(size_t));
+    c->wutf8s = malloc(c->count * sizeof(uint8_t *));
+    c->wutf8_lens = malloc(c->count * sizeof(size_t));
+    for (size_t i = 0; i != c->count; ++i) {
+        const uint8_t *s = (const uint8_t *)c->c_strs[i];
+        size_t size;
+        c->utf16s[i] = malloc((c->lens[i] + 1) * sizeof(uint16_t));
+        if (arf_decode_utf16(s, c->lens[i], c->utf16s[i], c->lens[i] + 1,
+                             &size) != ARF_OK)
+        {
+            for (size = 0; size != c->lens[i]; ++size)
+                c->utf16s[i][size] = s[size] < 0x80 ? s[size] : 0xdc00 | s[size];
+            size += 1;
+        }
+        c->utf16_lens[i] = size - 1;
+
+        size = arf_encode_utf16(c->utf16s[i], c->utf16_lens[i], NULL, 0);
+        c->wutf8s[i] = malloc(size);
+        arf_encode_utf16(c->utf16s[i], c->utf16_lens[i], c->wutf8s[i], size);
+        c->wutf8_lens[i] = size;
+        c->wutf8_bytes += size;
+    }
+}
+
+// Scratch space for outputs, big enough for any of them.
+static uint8_t *scratch;
+static size_t *scratch_offsets;
+static uint64_t *scan_bitmap;
+
+// Each benchmark makes one pass over a corpus and returns a value derived
+// from the results, so that the work can't be optimized away. `strings` and
+// `bytes` are set to the amount of input processed.
+typedef size_t (*bench_fn)(const struct corpus *c, size_t *strings,
+                           size_t *bytes);
+
+static size_t bench_is_valid_c_str(const struct corpus *c, size_t *strings,
+                                   size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i)
+        sink += arf_is_valid_c_str(c->c_strs[i]);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_categorize_c_str(const struct corpus *c, size_t *strings,
+                                     size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t len;
+        sink += arf_categorize_c_str(c->c_strs[i], &len) + len;
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_sizeof_c_str_arf(const struct corpus *c, size_t *strings,
+                                     size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i)
+        sink += arf_sizeof_c_str_arf(c->c_strs[i]);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_c_str_arf(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        arf_c_str_arf(c->c_strs[i], scratch);
+        sink += scratch[0];
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_encode(const struct corpus *c, size_t *strings,
+                           size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i)
+        sink += arf_encode((const uint8_t *)c->c_strs[i], c->lens[i], scratch,
+                           c->max_utf8_len);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+// The sequence a host which categorizes first would follow with a scan:
+// scan each string once, size its UTF-8 form, then write it.
+static size_t bench_scan(const struct corpus *c, size_t *strings,
+                         size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        struct arf_scan scan;
+        sink += arf_scan_init(&scan, (const uint8_t *)c->c_strs[i], c->lens[i],
+                              scan_bitmap);
+        size_t size = arf_scan_size(&scan);
+        sink += arf_scan_encode(&scan, scratch, size);
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+// The same sequence without a scan, for comparison.
+static size_t bench_no_scan(const struct corpus *c, size_t *strings,
+                            size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t len;
+        if (arf_categorize_c_str(c->c_strs[i], &len)) {
+            memcpy(scratch, c->c_strs[i], len);
+        } else {
+            sink += arf_sizeof_c_str_arf(c->c_strs[i]);
+            arf_c_str_arf(c->c_strs[i], scratch);
+        }
+        sink += len;
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_sizeof_c_strs_arf(const struct corpus *c, size_t *strings,
+                                      size_t *bytes) {
+    size_t count;
+    size_t sink = arf_sizeof_c_strs_arf((const char *const *)c->c_strs, &count);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink + count;
+}
+
+static size_t bench_c_strs_arf(const struct corpus *c, size_t *strings,
+                               size_t *bytes) {
+    arf_c_strs_arf((const char *const *)c->c_strs, scratch, scratch_offsets);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return scratch_offsets[c->count - 1];
+}
+
+static size_t bench_has_arf_magic(const struct corpus *c, size_t *strings,
+                                  size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i)
+        sink += arf_has_arf_magic(c->utf8s[i], c->utf8_lens[i]);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_is_valid_arf(const struct corpus *c, size_t *strings,
+                                 size_t *bytes) {
+    size_t sink = 0;
+    for (size_t j = 0; j != c->arf_count; ++j) {
+        size_t i = c->arf_indices[j];
+        sink += arf_is_valid_arf(c->utf8s[i], c->utf8_lens[i]);
+    }
+    *strings = c->arf_count;
+    *bytes = c->arf_bytes;
+    return sink;
+}
+
+static size_t bench_sizeof_arf_c_str(const struct corpus *c, size_t *strings,
+                                     size_t *bytes) {
+    size_t sink = 0;
+    for (size_t j = 0; j != c->arf_count; ++j) {
+        size_t i = c->arf_indices[j];
+        sink += arf_sizeof_arf_c_str(c->utf8s[i], c->utf8_lens[i]);
+    }
+    *strings = c->arf_count;
+    *bytes = c->arf_bytes;
+    return sink;
+}
+
+static size_t bench_arf_c_str(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    size_t sink = 0;
+    for (size_t j = 0; j != c->arf_count; ++j) {
+        size_t i = c->arf_indices[j];
+        arf_arf_c_str(c->utf8s[i], c->utf8_lens[i], (char *)scratch);
+        sink += scratch[0];
+    }
+    *strings = c->arf_count;
+    *bytes = c->arf_bytes;
+    return sink;
+}
+
+static size_t bench_decode(const struct corpus *c, size_t *strings,
+                           size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t size;
+        sink += arf_decode(c->utf8s[i], c->utf8_lens[i], (char *)scratch,
+                           c->max_utf8_len + 1, &size);
+        sink += size;
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_decode_trusted(const struct corpus *c, size_t *strings,
+                                   size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_decode_trusted(c->utf8s[i], c->utf8_lens[i],
+                                   (char *)scratch);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+// Each string is copied into the scratch buffer first, as a host copying it
+// out of guest memory would, and decoded there.
+static size_t bench_decode_in_place(const struct corpus *c, size_t *strings,
+                                    size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t size;
+        memcpy(scratch, c->utf8s[i], c->utf8_lens[i]);
+        sink += arf_decode_in_place(scratch, c->utf8_lens[i],
+                                    c->max_utf8_len + 1, &size);
+        sink += size;
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+// The sequence a caller would follow for each string with a view: parse it
+// once, then hash it and decode it.
+static size_t bench_view(const struct corpus *c, size_t *strings,
+                         size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        struct arf_view view;
+        if (arf_view_init(&view, c->utf8s[i], c->utf8_lens[i]) != ARF_OK)
+            continue;
+        sink += arf_view_hash(0, &view);
+        arf_view_c_str(&view, (char *)scratch);
+        sink += view.host_len;
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+// The same sequence without a view, for comparison.
+static size_t bench_no_view(const struct corpus *c, size_t *strings,
+                            size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t size;
+        if (arf_decode(c->utf8s[i], c->utf8_lens[i], NULL, 0, &size) ==
+            ARF_INVALID)
+            continue;
+        sink += arf_hash(0, c->utf8s[i], c->utf8_lens[i]);
+        sink += arf_decode_trusted(c->utf8s[i], c->utf8_lens[i],
+                                   (char *)scratch);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_encode_in(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    static struct arf_arena arena;
+    size_t sink = 0;
+    arf_arena_reset(&arena);
+    for (size_t i = 0; i != c->count; ++i) {
+        const uint8_t *out;
+        size_t len;
+        sink += arf_encode_in(&arena, (const uint8_t *)c->c_strs[i], c->lens[i],
+                              &out, &len);
+        sink += len;
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_decode_in(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    static struct arf_arena arena;
+    size_t sink = 0, total = 0;
+    arf_arena_reset(&arena);
+    for (size_t i = 0; i != c->count; ++i) {
+        const char *out;
+        size_t size;
+        sink += arf_decode_in(&arena, c->utf8s[i], c->utf8_lens[i], &out, &size);
+        sink += size;
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_encoder(const struct corpus *c, size_t *strings,
+                            size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        struct arf_encoder enc;
+        arf_encoder_init(&enc);
+        sink += arf_encoder_update(&enc, (const uint8_t *)c->c_strs[i],
+                                   c->lens[i], scratch);
+        sink += arf_sizeof_encoder_finish(&enc);
+        sink += arf_encoder_finish(&enc, scratch);
+        arf_encoder_destroy(&enc);
+    }
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_decoder(const struct corpus *c, size_t *strings,
+                            size_t *bytes) {
+    size_t sink = 0;
+    for (size_t j = 0; j != c->arf_count; ++j) {
+        size_t i = c->arf_indices[j];
+        struct arf_decoder dec;
+        arf_decoder_init(&dec);
+        size_t len = arf_decoder_update(&dec, c->utf8s[i], c->utf8_lens[i],
+                                        (char *)scratch);
+        sink += len + arf_decoder_finish(&dec, (char *)scratch + len);
+        arf_decoder_destroy(&dec);
+    }
+    *strings = c->arf_count;
+    *bytes = c->arf_bytes;
+    return sink;
+}
+
+static size_t bench_encode_utf16(const struct corpus *c, size_t *strings,
+                                 size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_encode_utf16(c->utf16s[i], c->utf16_lens[i], scratch,
+                                 c->wutf8_lens[i]);
+        total += c->utf16_lens[i] * sizeof(uint16_t);
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_decode_utf16(const struct corpus *c, size_t *strings,
+                                 size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        size_t size;
+        sink += arf_decode_utf16(c->wutf8s[i], c->wutf8_lens[i],
+                                 (uint16_t *)scratch, c->utf16_lens[i] + 1,
+                                 &size);
+        sink += size;
+    }
+    *strings = c->count;
+    *bytes = c->wutf8_bytes;
+    return sink;
+}
+
+static size_t bench_path_join(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    static const char name[] = "child-\xc3\xa9t\xc3\xa9";
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_path_join(c->utf8s[i], c->utf8_lens[i],
+                              (const uint8_t *)name, sizeof(name) - 1, scratch,
+                              c->max_utf8_len + sizeof(name));
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_path_parent(const struct corpus *c, size_t *strings,
+                                size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_path_parent(c->utf8s[i], c->utf8_lens[i], scratch,
+                                c->max_utf8_len);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_path_basename(const struct corpus *c, size_t *strings,
+                                  size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_path_basename(c->utf8s[i], c->utf8_lens[i], scratch,
+                                  c->max_utf8_len);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_hash_host(const struct corpus *c, size_t *strings,
+                              size_t *bytes) {
+    size_t sink = 0;
+    for (size_t i = 0; i != c->count; ++i)
+        sink += arf_hash_host(0, (const uint8_t *)c->c_strs[i], c->lens[i]);
+    *strings = c->count;
+    *bytes = c->bytes;
+    return sink;
+}
+
+static size_t bench_hash(const struct corpus *c, size_t *strings,
+                         size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_hash(0, c->utf8s[i], c->utf8_lens[i]);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+// Compare each string with itself, which is the worst case: every byte has
+// to be looked at.
+static size_t bench_compare(const struct corpus *c, size_t *strings,
+                            size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += (size_t)arf_compare(c->utf8s[i], c->utf8_lens[i], c->utf8s[i],
+                                    c->utf8_lens[i]);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static size_t bench_equal_host(const struct corpus *c, size_t *strings,
+                               size_t *bytes) {
+    size_t sink = 0, total = 0;
+    for (size_t i = 0; i != c->count; ++i) {
+        sink += arf_equal_host(c->utf8s[i], c->utf8_lens[i],
+                               (const uint8_t *)c->c_strs[i], c->lens[i]);
+        total += c->utf8_lens[i];
+    }
+    *strings = c->count;
+    *bytes = total;
+    return sink;
+}
+
+static const struct {
+    const char *name;
+    bench_fn fn;
+} benches[] = {
+    { "arf_is_valid_c_str", bench_is_valid_c_str },
+    { "arf_categorize_c_str", bench_categorize_c_str },
+    { "arf_sizeof_c_str_arf", bench_sizeof_c_str_arf },
+    { "arf_c_str_arf", bench_c_str_arf },
+    { "arf_encode", bench_encode },
+    { "arf_scan", bench_scan },
+    { "arf_categorize+c_str_arf", bench_no_scan },
+    { "arf_sizeof_c_strs_arf", bench_sizeof_c_strs_arf },
+    { "arf_c_strs_arf", bench_c_strs_arf },
+    { "arf_has_arf_magic", bench_has_arf_magic },
+    { "arf_is_valid_arf", bench_is_valid_arf },
+    { "arf_sizeof_arf_c_str", bench_sizeof_arf_c_str },
+    { "arf_arf_c_str", bench_arf_c_str },
+    { "arf_decode", bench_decode },
+    { "arf_decode_trusted", bench_decode_trusted },
+    { "arf_decode_in_place", bench_decode_in_place },
+    { "arf_view", bench_view },
+    { "arf_decode+arf_hash", bench_no_view },
+    { "arf_encode_in", bench_encode_in },
+    { "arf_decode_in", bench_decode_in },
+    { "arf_encoder", bench_encoder },
+    { "arf_decoder", bench_decoder },
+    { "arf_encode_utf16", bench_encode_utf16 },
+    { "arf_decode_utf16", bench_decode_utf16 },
+    { "arf_path_join", bench_path_join },
+    { "arf_path_parent", bench_path_parent },
+    { "arf_path_basename", bench_path_basename },
+    { "arf_hash_host", bench_hash_host },
+    { "arf_hash", bench_hash },
+    { "arf_compare", bench_compare },
+    { "arf_equal_host", bench_equal_host },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    double min_time = 0.2;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            min_time = strtod(argv[++i], NULL);
+        } else if (argv[i][0] != '-' && filter == NULL) {
+            filter = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--time SECONDS] [FILTER]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    struct corpus corpora[7];
+    make_corpus(&corpora[0], "ascii", gen_ascii);
+    make_corpus(&corpora[1], "cjk", gen_cjk);
+    make_corpus(&corpora[2], "sparse-invalid", gen_sparse_invalid);
+    make_corpus(&corpora[3], "dense-invalid", gen_dense_invalid);
+    make_corpus(&corpora[4], "long", gen_long);
+    make_corpus(&corpora[5], "dirnames", gen_dirnames);
+    make_corpus(&corpora[6], "latin1", gen_latin1);
+    const size_t corpus_count = sizeof(corpora) / sizeof(corpora[0]);
+
+    // The batch functions write every result into one buffer.
+    size_t scratch_size = 0, max_count = 0;
+    for (size_t i = 0; i != corpus_count; ++i) {
+        size_t count;
+        size_t size = arf_sizeof_c_strs_arf(
+            (const char *const *)corpora[i].c_strs, &count);
+        if (size > scratch_size)
+            scratch_size = size;
+        if (count > max_count)
+            max_count = count;
+    }
+    scratch = malloc(scratch_size);
+    scratch_offsets = malloc(max_count * sizeof(size_t));
+    scan_bitmap = malloc(ARF_SCAN_WORDS(scratch_size) * sizeof(uint64_t));
+
+    if (!json)
+        printf("%-40s %12s %12s\n", "function/corpus", "ns/string", "GB/s");
+
+    size_t sink = 0;
+    for (size_t b = 0; b != sizeof(benches) / sizeof(benches[0]); ++b) {
+        for (size_t i = 0; i != corpus_count; ++i) {
+            const struct corpus *c = &corpora[i];
+            char name[128];
+            snprintf(name, sizeof(name), "%s/%s", benches[b].name, c->name);
+            if (filter && strstr(name, filter) == NULL)
+                continue;
+
+            // Warm up, and skip functions which have nothing to do here,
+            // such as ARF decoding on corpora with no invalid strings.
+            size_t strings, bytes;
+            sink += benches[b].fn(c, &strings, &bytes);
+            if (strings == 0)
+                continue;
+
+            size_t passes = 0;
+            double start = now(), elapsed;
+            do {
+                sink += benches[b].fn(c, &strings, &bytes);
+                passes += 1;
+                elapsed = now() - start;
+            } while (elapsed < min_time);
+
+            double ns_per_string = elapsed * 1e9 / (double)(passes * strings);
+            double gb_per_s = (double)(passes * bytes) / elapsed * 1e-9;
+            if (json) {
+                printf("{\"function\":\"%s\",\"corpus\":\"%s\",\"strings\":%zu,"
+                       "\"bytes\":%zu,\"ns_per_string\":%.3f,\"gb_per_s\":%.4f}\n",
+                       benches[b].name, c->name, strings, bytes, ns_per_string,
+                       gb_per_s);
+            } else {
+                printf("%-40s %12.2f %12.3f\n", name, ns_per_string, gb_per_s);
+            }
+            fflush(stdout);
+        }
+    }
+
+    // Make sure the results are used.
+    return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+//! Benchmark converting a working set of Latin-1 paths back and forth, as a
+//! WASI host does on each `stat` or `open`, with and without an `arf_cache`.
+//!
+//! Build with CMake (`cmake --build . --target arf_bench_cache`), or with:
+//!
+//!     cc -O2 -I.. cache.c ../arf.c ../arf_cache.c -lpthread -o cache
+//!
+//! and run as:
+//!
+//!     ./cache [paths [threads [budget]]]
+//!
+//! The defaults are 4000 paths, one thread, and a 4 MiB budget. Each round
+//! encodes every path and decodes the result, and the times are per path.
+
+#define _GNU_SOURCE
+#include "arf.h"
+#include "arf_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const int rounds = 50;
+
+static char **paths;
+static size_t path_count;
+static struct arf_cache cache;
+
+static size_t convert_uncached(void) {
+    uint8_t utf8[512];
+    char host[512];
+    size_t sink = 0;
+    for (size_t i = 0; i != path_count; ++i) {
+        size_t len = arf_encode((const uint8_t *)paths[i], strlen(paths[i]),
+                                utf8, sizeof(utf8));
+        size_t size;
+        sink += arf_decode(utf8, len, host, sizeof(host), &size);
+        sink += size;
+    }
+    return sink;
+}
+
+static size_t convert_cached(void) {
+    uint8_t utf8[512];
+    char host[512];
+    size_t sink = 0;
+    for (size_t i = 0; i != path_count; ++i) {
+        size_t len = arf_cache_encode(&cache, (const uint8_t *)paths[i],
+                                      strlen(paths[i]), utf8, sizeof(utf8));
+        size_t size;
+        sink += arf_cache_decode(&cache, utf8, len, host, sizeof(host), &size);
+        sink += size;
+    }
+    return sink;
+}
+
+struct run {
+    size_t (*fn)(void);
+    size_t sink;
+};
+
+static void *run_rounds(void *arg) {
+    struct run *run = arg;
+    for (int r = 0; r != rounds; ++r)
+        run->sink += run->fn();
+    return NULL;
+}
+
+// Run `fn` for every round on each of `threads` threads, and return the
+// time per path per thread in nanoseconds.
+static double measure(size_t (*fn)(void), size_t threads, size_t *sink) {
+    pthread_t *ids = calloc(threads, sizeof(*ids));
+    struct run *runs = calloc(threads, sizeof(*runs));
+    double start = now();
+    for (size_t t = 0; t != threads; ++t) {
+        runs[t].fn = fn;
+        pthread_create(&ids[t], NULL, run_rounds, &runs[t]);
+    }
+    for (size_t t = 0; t != threads; ++t) {
+        pthread_join(ids[t], NULL);
+        *sink += runs[t].sink;
+    }
+    double elapsed = now() - start;
+    free(ids);
+    free(runs);
+    return elapsed * 1e9 / ((double)rounds * (double)path_count);
+}
+
+int main(int argc, char **argv) {
+    path_count = argc > 1 ? strtoul(argv[1], NULL, 0) : 4000;
+    size_t threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    size_t budget = argc > 3 ? strtoul(argv[3], NULL, 0) : 4 << 20;
+
+    // Paths under legacy Latin-1 directories, each with an invalid byte.
+    paths = calloc(path_count, sizeof(*paths));
+    for (size_t i = 0; i != path_count; ++i) {
+        paths[i] = malloc(128);
+        snprintf(paths[i], 128, "/data/caf\xe9/%zu/r\xe9sum\xe9-%zu.csv",
+                 i % 37, i);
+    }
+    if (!arf_cache_init(&cache, budget)) {
+        fprintf(stderr, "arf_cache_init failed\n");
+        return 1;
+    }
+
+    size_t sink = 0;
+    double uncached = measure(convert_uncached, threads, &sink);
+    // Fill the cache, then measure it warm.
+    sink += convert_cached();
+    double cached = measure(convert_cached, threads, &sink);
+
+    struct arf_cache_stats stats;
+    arf_cache_get_stats(&cache, &stats);
+    printf("%-24s %12s\n", "conversion", "ns/path");
+    printf("%-24s %12.2f\n", "arf_encode+arf_decode", uncached);
+    printf("%-24s %12.2f\n", "arf_cache", cached);
+    printf("hits %llu, misses %llu, evictions %llu, entries %zu, bytes %zu\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           (unsigned long long)stats.evictions, stats.entries, stats.bytes);
+
+    arf_cache_destroy(&cache);
+    for (size_t i = 0; i != path_count; ++i)
+        free(paths[i]);
+    free(paths);
+
+    // Make sure the results are used.
+    return sink == 42 ? 1 : 0;
+}
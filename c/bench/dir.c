@@ -0,0 +1,124 @@
+//! Benchmark listing a big directory and converting every name to UTF-8,
+//! with `readdir` and per-name allocation versus `arf_dir_next`.
+//!
+//! Build and run with:
+//!
+//!     cc -O2 -I.. dir.c ../arf.c ../arf_dir.c -o dir
+//!     ./dir [entries [invalid-per-mille [parent-directory]]]
+//!
+//! The directory is created, populated, and removed again by the benchmark.
+//! The defaults are 1000000 entries, 10 per mille of them not UTF-8, in /tmp.
+
+#define _GNU_SOURCE
+#include "arf.h"
+#include "arf_dir.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Write the name of the `i`th entry. The first `per_mille` names of every
+// thousand have an invalid byte in them.
+static void entry_name(char *buf, size_t i, unsigned per_mille) {
+    bool invalid = per_mille != 0 && i % 1000 < per_mille;
+    sprintf(buf, "%sentry-%zu-\xc3\xa9t\xc3\xa9", invalid ? "\xff" : "", i);
+}
+
+// List the directory as a typical caller did before `arf_dir`: `readdir`,
+// then categorize each name and allocate and encode it if needed.
+static size_t list_readdir(int fd) {
+    DIR *d = fdopendir(dup(fd));
+    struct dirent *ent;
+    size_t total = 0;
+
+    rewinddir(d);
+    while ((ent = readdir(d)) != NULL) {
+        size_t len;
+        if (arf_categorize_c_str(ent->d_name, &len)) {
+            total += len;
+        } else {
+            uint8_t *arf = malloc(len);
+            arf_c_str_arf(ent->d_name, arf);
+            total += len + arf[len - 1];
+            free(arf);
+        }
+    }
+    closedir(d);
+    return total;
+}
+
+static size_t list_arf_dir(int fd) {
+    static uint8_t buf[256 * 1024];
+    struct arf_dir dir;
+    struct arf_dirent ent;
+    size_t total = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    arf_dir_init(&dir, fd, buf, sizeof(buf));
+    while (arf_dir_next(&dir, &ent) == 1)
+        total += ent.name_len + (ent.arf ? ent.name[ent.name_len - 1] : 0);
+    return total;
+}
+
+int main(int argc, char **argv) {
+    size_t entries = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    unsigned per_mille = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 10;
+    const char *parent = argc > 3 ? argv[3] : "/tmp";
+    char path[4096], name[64];
+
+    snprintf(path, sizeof(path), "%s/arf-bench-XXXXXX", parent);
+    if (mkdtemp(path) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+
+    printf("populating %s with %zu entries...\n", path, entries);
+    for (size_t i = 0; i != entries; ++i) {
+        entry_name(name, i, per_mille);
+        int file = openat(fd, name, O_CREAT | O_WRONLY, 0600);
+        if (file < 0) {
+            perror("openat");
+            return 1;
+        }
+        close(file);
+    }
+
+    // Warm the dentry cache, then take the best of several runs of each.
+    size_t expected = list_readdir(fd);
+    double best_readdir = 1e9, best_arf_dir = 1e9;
+    for (int run = 0; run != 5; ++run) {
+        double start = now();
+        if (list_readdir(fd) != expected)
+            abort();
+        double mid = now();
+        if (list_arf_dir(fd) != expected)
+            abort();
+        double end = now();
+
+        if (mid - start < best_readdir)
+            best_readdir = mid - start;
+        if (end - mid < best_arf_dir)
+            best_arf_dir = end - mid;
+    }
+
+    printf("readdir + malloc: %8.2f ns/entry\n", best_readdir * 1e9 / entries);
+    printf("arf_dir_next:     %8.2f ns/entry\n", best_arf_dir * 1e9 / entries);
+
+    for (size_t i = 0; i != entries; ++i) {
+        entry_name(name, i, per_mille);
+        unlinkat(fd, name, 0);
+    }
+    close(fd);
+    rmdir(path);
+    return 0;
+}
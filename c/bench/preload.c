@@ -0,0 +1,162 @@
+//! Benchmark the overhead of libarf_preload.so on path-taking calls, for
+//! plain paths and ARF paths.
+//!
+//! Build with CMake (`cmake --build . --target arf_bench_preload`), or with:
+//!
+//!     cc -O2 -I.. preload.c ../arf.c -L.. -larf_preload -ldl -o preload
+//!
+//! and run as:
+//!
+//!     ./preload [calls]
+//!
+//! It's linked against the shim, so its calls to `access` and `stat` go
+//! through it, and it looks up libc's own definitions to compare against.
+//! Each measurement is the fastest of several rounds, to filter out noise
+//! from the system calls themselves.
+
+#define _GNU_SOURCE
+#include "arf_preload.h"
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const int rounds = 20;
+
+static int (*libc_access)(const char *, int);
+static int (*libc_stat)(const char *, struct stat *);
+
+static size_t bench_check(const char *path, size_t calls) {
+    static char buf[PATH_MAX];
+    size_t sink = 0;
+    for (size_t i = 0; i != calls; ++i) {
+        // Keep the compiler from hoisting the call out of the loop.
+        __asm__ volatile("" : "+r"(path));
+        sink += arf_preload_host_path(path, buf, sizeof(buf)) == path;
+    }
+    return sink;
+}
+
+static size_t bench_access(const char *path, size_t calls) {
+    size_t sink = 0;
+    for (size_t i = 0; i != calls; ++i)
+        sink += access(path, F_OK) == 0;
+    return sink;
+}
+
+static size_t bench_libc_access(const char *path, size_t calls) {
+    size_t sink = 0;
+    for (size_t i = 0; i != calls; ++i)
+        sink += libc_access(path, F_OK) == 0;
+    return sink;
+}
+
+static size_t bench_stat(const char *path, size_t calls) {
+    struct stat st;
+    size_t sink = 0;
+    for (size_t i = 0; i != calls; ++i)
+        sink += stat(path, &st) == 0;
+    return sink;
+}
+
+static size_t bench_libc_stat(const char *path, size_t calls) {
+    struct stat st;
+    size_t sink = 0;
+    for (size_t i = 0; i != calls; ++i)
+        sink += libc_stat(path, &st) == 0;
+    return sink;
+}
+
+// The fastest time per call of `fn` over several rounds, in nanoseconds.
+static double measure(size_t (*fn)(const char *, size_t), const char *path,
+                      size_t calls, size_t *sink) {
+    double best = 1e30;
+    for (int r = 0; r != rounds; ++r) {
+        double start = now();
+        *sink += fn(path, calls);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best * 1e9 / (double)calls;
+}
+
+int main(int argc, char **argv) {
+    size_t calls = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+
+    // The shim only decodes ARF paths when asked to.
+    setenv("ARF_PRELOAD_READ_PAST_NUL", "1", 1);
+
+    void *libc = dlopen("libc.so.6", RTLD_LAZY | RTLD_NOLOAD);
+    if (libc == NULL) {
+        fprintf(stderr, "dlopen: %s\n", dlerror());
+        return 1;
+    }
+    libc_access = (int (*)(const char *, int))dlsym(libc, "access");
+    libc_stat = (int (*)(const char *, struct stat *))dlsym(libc, "stat");
+
+    // A file with a non-UTF-8 name, and the ARF string which names it.
+    char dir[] = "/tmp/arf_bench_preload.XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        perror(dir);
+        return 1;
+    }
+    static const char plain[] = "file-\xc3\xa9t\xc3\xa9";
+    static const char invalid[] = "file-\xe9t\xe9";
+    uint8_t arf[64] = { 0 };
+    arf_encode((const uint8_t *)invalid, strlen(invalid), arf, sizeof(arf) - 1);
+    fclose(fopen(plain, "w"));
+    fclose(fopen(invalid, "w"));
+
+    size_t sink = 0;
+    printf("%-28s %12s %12s %12s\n", "call", "shim ns", "libc ns", "overhead");
+
+    double check = measure(bench_check, plain, calls * 100, &sink);
+    printf("%-28s %12.2f %12s %12.2f\n", "arf_preload_host_path/plain",
+           check, "-", check);
+
+    // Alternate between the two, so that they see the same conditions.
+    double shim = 1e30, direct = 1e30;
+    for (int i = 0; i != 5; ++i) {
+        double s = measure(bench_access, plain, calls, &sink);
+        double d = measure(bench_libc_access, plain, calls, &sink);
+        shim = s < shim ? s : shim;
+        direct = d < direct ? d : direct;
+    }
+    printf("%-28s %12.2f %12.2f %12.2f\n", "access/plain", shim, direct,
+           shim - direct);
+    double arf_access = measure(bench_access, (const char *)arf, calls, &sink);
+    printf("%-28s %12.2f %12.2f %12.2f\n", "access/arf", arf_access, direct,
+           arf_access - direct);
+
+    shim = 1e30, direct = 1e30;
+    for (int i = 0; i != 5; ++i) {
+        double s = measure(bench_stat, plain, calls, &sink);
+        double d = measure(bench_libc_stat, plain, calls, &sink);
+        shim = s < shim ? s : shim;
+        direct = d < direct ? d : direct;
+    }
+    printf("%-28s %12.2f %12.2f %12.2f\n", "stat/plain", shim, direct,
+           shim - direct);
+    double arf_stat = measure(bench_stat, (const char *)arf, calls, &sink);
+    printf("%-28s %12.2f %12.2f %12.2f\n", "stat/arf", arf_stat, direct,
+           arf_stat - direct);
+
+    unlink(plain);
+    unlink(invalid);
+    if (chdir("/") != 0 || rmdir(dir) != 0)
+        perror(dir);
+
+    // Make sure the results are used.
+    return sink == 42 ? 1 : 0;
+}
@@ -1,14 +1,562 @@
 #undef NDEBUG
+#define _GNU_SOURCE
+#ifdef ARF_TEST_INLINE
+#include "arf_inline.h"
+#else
 #include "arf.h"
+#endif
+#include "arf_cache.h"
+#include "arf_dir.h"
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
 
 #define UTF8_BOM "\xef\xbb\xbf"
 #define UTF8_REPLACEMENT "\xef\xbf\xbd"
 
 #define ptr_len(s) ((const uint8_t *)(s)), (sizeof(s) - 1)
 
+// Embed `snippet` at every offset within a longer string, so that it's seen
+// by the vectorized validation paths rather than just the scalar tail, and
+// check that the results agree with those for the snippet on its own.
+static void check_embedded(const char *snippet) {
+    char buffer[256];
+    size_t snippet_len = strlen(snippet);
+    size_t suffix_len = 70;
+    bool valid = arf_is_valid_c_str(snippet);
+    size_t arf_len = arf_sizeof_c_str_arf(snippet);
+
+    for (size_t prefix_len = 0; prefix_len != 130; ++prefix_len) {
+        size_t i = 0;
+        while (i != prefix_len) {
+            if (i % 5 == 0 && prefix_len - i >= 2) {
+                buffer[i++] = '\xc3';
+                buffer[i++] = '\xa9';
+            } else {
+                buffer[i++] = 'a';
+            }
+        }
+        memcpy(buffer + i, snippet, snippet_len);
+        i += snippet_len;
+        memset(buffer + i, 'z', suffix_len);
+        i += suffix_len;
+        buffer[i] = '\0';
+
+        assert(arf_is_valid_c_str(buffer) == valid);
+        assert(arf_sizeof_c_str_arf(buffer) ==
+               arf_len + 2 * (prefix_len + suffix_len));
+    }
+}
+
+// A small deterministic generator for the kernel tests.
+static uint64_t test_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Check that every validation kernel this CPU can run finds the same first
+// invalid byte in the `len` bytes at `ptr` as the scalar reference does.
+static void check_kernels(const uint8_t *ptr, size_t len) {
+    size_t expected =
+        arf_utf8_valid_up_to_with(ARF_UTF8_KERNEL_SCALAR, ptr, len);
+    assert(expected <= len);
+    assert(arf_utf8_valid_up_to(ptr, len) == expected);
+    for (int k = ARF_UTF8_KERNEL_AUTO; k <= ARF_UTF8_KERNEL_AVX512; ++k) {
+        size_t got = arf_utf8_valid_up_to_with((enum arf_utf8_kernel)k, ptr,
+                                               len);
+        assert(got == expected || got == SIZE_MAX);
+    }
+}
+
+// Run the kernels over random bytes, and over random UTF-8 with a few bytes
+// changed, at every alignment.
+static void check_kernels_random(void) {
+    static const char *const pieces[] = {
+        "a", "/", "\xc2\x80", "\xc3\xa9", "\xdf\xbf", "\xe0\xa0\x80",
+        "\xe4\xb8\xad", "\xed\x9f\xbf", "\xee\x80\x80", UTF8_REPLACEMENT,
+        "\xef\xbf\xbc", "\xf0\x90\x80\x80", "\xf0\x9f\x90\xb0",
+        "\xf4\x8f\xbf\xbf", "0123456789abcdef0123456789abcdef",
+    };
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    uint64_t state = 0x9e3779b97f4a7c15;
+    uint8_t buffer[600];
+
+    // The kernel built and supported here must be at least one of them.
+    assert(arf_utf8_valid_up_to_with(ARF_UTF8_KERNEL_AUTO, ptr_len("a")) == 1);
+
+    for (int i = 0; i != 2000; ++i) {
+        size_t len = test_random(&state) % 300;
+        for (size_t j = 0; j != len; ++j)
+            buffer[j] = (uint8_t)test_random(&state);
+        check_kernels(buffer, len);
+    }
+
+    for (int i = 0; i != 4000; ++i) {
+        size_t len = 0, target = test_random(&state) % 520;
+        while (len < target) {
+            const char *piece = pieces[test_random(&state) % piece_count];
+            memcpy(buffer + len, piece, strlen(piece));
+            len += strlen(piece);
+        }
+        check_kernels(buffer, len);
+
+        size_t mutations = len == 0 ? 0 : test_random(&state) % 4;
+        for (size_t m = 0; m != mutations; ++m) {
+            uint64_t r = test_random(&state);
+            buffer[(r >> 8) % len] =
+                (r & 1) ? (uint8_t)(r >> 32) : (uint8_t)(0x80 | (r >> 32));
+        }
+        for (size_t start = 0; start != 4 && start <= len; ++start)
+            check_kernels(buffer + start, len - start);
+    }
+}
+
+// Check that sizing and encoding `c_str` from a scan gives the same result
+// as `arf_encode`, including when the buffer is one byte short.
+static void check_scan(const char *c_str) {
+    uint8_t expected[256], utf8[256];
+    size_t c_str_len = strlen(c_str);
+    size_t len = arf_encode((const uint8_t *)c_str, c_str_len, expected,
+                            sizeof(expected));
+    assert(len <= sizeof(expected));
+
+    struct arf_scan scan;
+    uint64_t bitmap[ARF_SCAN_WORDS(256)];
+    assert(c_str_len <= 256);
+    assert(arf_scan_init(&scan, (const uint8_t *)c_str, c_str_len, bitmap) ==
+           arf_is_valid_c_str(c_str));
+    assert(arf_scan_size(&scan) == len);
+    if (len != 0)
+        assert(arf_scan_encode(&scan, utf8, len - 1) == len);
+    memset(utf8, 0xee, sizeof(utf8));
+    assert(arf_scan_encode(&scan, utf8, len) == len);
+    assert(memcmp(utf8, expected, len) == 0 && utf8[len] == 0xee);
+}
+
+// Stream `c_str` through an encoder and the result back through a decoder,
+// split into chunks of every size, and check that the results match the
+// whole-string conversions.
+static void check_streaming(const char *c_str) {
+    uint8_t expected[256], arf[256];
+    char host[256];
+    size_t c_str_len = strlen(c_str);
+    size_t arf_len = arf_sizeof_c_str_arf(c_str);
+    arf_c_str_arf(c_str, expected);
+    check_scan(c_str);
+
+    for (size_t chunk = 1; chunk <= c_str_len + 1; ++chunk) {
+        struct arf_encoder enc;
+        size_t len = 0;
+        arf_encoder_init(&enc);
+        for (size_t i = 0; i < c_str_len; i += chunk) {
+            size_t n = c_str_len - i < chunk ? c_str_len - i : chunk;
+            len += arf_encoder_update(&enc, (const uint8_t *)c_str + i, n,
+                                      arf + len);
+        }
+        assert(len + arf_sizeof_encoder_finish(&enc) == arf_len);
+        len += arf_encoder_finish(&enc, arf + len);
+        arf_encoder_destroy(&enc);
+        assert(len == arf_len && memcmp(arf, expected, arf_len) == 0);
+    }
+
+    if (arf_is_valid_c_str(c_str))
+        return;
+
+    for (size_t chunk = 1; chunk <= arf_len; ++chunk) {
+        struct arf_decoder dec;
+        size_t len = 0;
+        arf_decoder_init(&dec);
+        for (size_t i = 0; i < arf_len; i += chunk) {
+            size_t n = arf_len - i < chunk ? arf_len - i : chunk;
+            size_t written = arf_decoder_update(&dec, expected + i, n,
+                                                host + len);
+            assert(written != SIZE_MAX);
+            len += written;
+        }
+        assert(arf_decoder_finish(&dec, host + len) == ARF_OK);
+        arf_decoder_destroy(&dec);
+        assert(len == c_str_len && memcmp(host, c_str, len + 1) == 0);
+    }
+
+    assert(arf_decode_trusted(expected, arf_len, host) == c_str_len + 1);
+    assert(memcmp(host, c_str, c_str_len + 1) == 0);
+
+    size_t size;
+    memcpy(arf, expected, arf_len);
+    assert(arf_decode_in_place(arf, arf_len, arf_len, &size) == ARF_OK);
+    assert(size == c_str_len + 1 && memcmp(arf, c_str, size) == 0);
+}
+
+// Stream `ptr` through a decoder a byte at a time.
+static enum arf_status decode_streaming(const uint8_t *ptr, size_t len) {
+    struct arf_decoder dec;
+    char host[256];
+    size_t host_len = 0;
+    enum arf_status status = ARF_OK;
+
+    arf_decoder_init(&dec);
+    for (size_t i = 0; i != len; ++i) {
+        size_t written = arf_decoder_update(&dec, ptr + i, 1, host + host_len);
+        if (written == SIZE_MAX)
+            break;
+        host_len += written;
+    }
+    status = arf_decoder_finish(&dec, host + host_len);
+    arf_decoder_destroy(&dec);
+    return status;
+}
+
+#ifdef __linux__
+// Create files with assorted names in a fresh directory, and check that
+// `arf_dir_next` reports each of them, converted as `arf_encode` would.
+static void check_dir(size_t cap) {
+    static const char *const names[] = {
+        "foo", "\xc3\xa9t\xc3\xa9", "foo\xff", "\xff\xfe", UTF8_BOM "bar\x80",
+    };
+    const size_t count = sizeof(names) / sizeof(names[0]);
+    bool seen[sizeof(names) / sizeof(names[0])] = { false };
+    char path[] = "/tmp/arf-test-XXXXXX";
+    uint8_t buf[4096], expected[ARF_DIR_NAME_MAX];
+    struct arf_dir dir;
+    struct arf_dirent ent;
+    size_t n = 0;
+    int r;
+
+    assert(mkdtemp(path) != NULL);
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    assert(fd >= 0);
+    for (size_t i = 0; i != count; ++i) {
+        int file = openat(fd, names[i], O_CREAT | O_WRONLY, 0600);
+        assert(file >= 0);
+        close(file);
+    }
+
+    arf_dir_init(&dir, fd, buf, cap);
+    while ((r = arf_dir_next(&dir, &ent)) == 1) {
+        ++n;
+        if (ent.name_len <= 2 && memcmp(ent.name, "..", ent.name_len) == 0) {
+            assert(!ent.arf && ent.type == DT_DIR);
+            continue;
+        }
+        assert(ent.type == DT_REG);
+
+        bool found = false;
+        for (size_t i = 0; i != count; ++i) {
+            size_t len = strlen(names[i]);
+            size_t size = arf_encode((const uint8_t *)names[i], len, expected,
+                                     sizeof(expected));
+            if (size == ent.name_len && memcmp(expected, ent.name, size) == 0) {
+                assert(ent.arf == (size != len));
+                assert(!seen[i]);
+                seen[i] = found = true;
+            }
+        }
+        assert(found);
+    }
+    assert(r == 0 && n == count + 2);
+
+    for (size_t i = 0; i != count; ++i)
+        assert(unlinkat(fd, names[i], 0) == 0);
+    close(fd);
+    assert(rmdir(path) == 0);
+}
+#endif
+
+// Encode `units` in the Windows scheme and check the result against
+// `expected`, then decode it and check that we get `units` back. Also embed
+// them at every offset within longer arrays, so that surrogates straddle the
+// vectorized blocks.
+static void check_utf16(const uint16_t *units, size_t len,
+                        const uint8_t *expected, size_t expected_len) {
+    uint8_t arf[256];
+    uint16_t host[128];
+    size_t size;
+
+    assert(arf_encode_utf16(units, len, arf, 0) == expected_len);
+    assert(arf_encode_utf16(units, len, arf, sizeof(arf)) == expected_len);
+    assert(memcmp(arf, expected, expected_len) == 0);
+    assert(arf_decode_utf16(arf, expected_len, host, 0, &size) == ARF_TOO_SMALL);
+    assert(size == len + 1);
+    assert(arf_decode_utf16(arf, expected_len, host, 128, &size) == ARF_OK);
+    assert(size == len + 1 && host[len] == 0);
+    assert(memcmp(host, units, len * sizeof(uint16_t)) == 0);
+
+    uint16_t longer[64];
+    for (size_t prefix_len = 0; prefix_len + len <= 48; ++prefix_len) {
+        for (size_t i = 0; i != prefix_len; ++i)
+            longer[i] = i % 3 == 0 ? 0x4e2d : 'a';
+        memcpy(longer + prefix_len, units, len * sizeof(uint16_t));
+        for (size_t i = prefix_len + len; i != 64; ++i)
+            longer[i] = 'z';
+
+        size_t arf_len = arf_encode_utf16(longer, 64, arf, sizeof(arf));
+        assert(arf_len <= sizeof(arf));
+        if (memchr(expected, '\0', expected_len) == NULL)
+            assert(arf_len == expected_len + (64 - len) + 2 * ((prefix_len + 2) / 3));
+        else
+            assert(arf_has_arf_magic(arf, arf_len));
+        assert(arf_decode_utf16(arf, arf_len, host, 128, &size) == ARF_OK);
+        assert(size == 65 && memcmp(host, longer, sizeof(longer)) == 0);
+    }
+}
+
+// The reference versions of the path functions, on host strings.
+static void host_parent(const char *path, char *out) {
+    size_t end = strlen(path);
+    while (end != 0 && path[end - 1] == '/')
+        end -= 1;
+    if (end == 0) {
+        strcpy(out, path[0] ? "/" : ".");
+        return;
+    }
+    while (end != 0 && path[end - 1] != '/')
+        end -= 1;
+    if (end == 0) {
+        strcpy(out, ".");
+        return;
+    }
+    while (end != 0 && path[end - 1] == '/')
+        end -= 1;
+    if (end == 0) {
+        strcpy(out, "/");
+        return;
+    }
+    memcpy(out, path, end);
+    out[end] = '\0';
+}
+
+static void host_basename(const char *path, char *out) {
+    size_t end = strlen(path);
+    while (end != 0 && path[end - 1] == '/')
+        end -= 1;
+    if (end == 0) {
+        strcpy(out, path[0] ? "/" : ".");
+        return;
+    }
+    size_t begin = end;
+    while (begin != 0 && path[begin - 1] != '/')
+        begin -= 1;
+    memcpy(out, path + begin, end - begin);
+    out[end - begin] = '\0';
+}
+
+// Check that `f`, applied to the UTF-8 form of `host`, gives the UTF-8 form
+// of `reference` applied to `host`, both into a separate buffer and in place.
+static void check_path_fn(const char *host,
+                          size_t (*f)(const uint8_t *, size_t, uint8_t *,
+                                      size_t),
+                          void (*reference)(const char *, char *)) {
+    uint8_t utf8[256], expected[256], actual[256];
+    char result[256];
+    size_t len = arf_encode((const uint8_t *)host, strlen(host), utf8,
+                            sizeof(utf8));
+    reference(host, result);
+    size_t expected_len = arf_encode((const uint8_t *)result, strlen(result),
+                                     expected, sizeof(expected));
+
+    assert(f(utf8, len, actual, 0) == expected_len);
+    assert(f(utf8, len, actual, sizeof(actual)) == expected_len);
+    assert(memcmp(actual, expected, expected_len) == 0);
+    assert(expected_len <= len || len == 0);
+    assert(f(utf8, len, utf8, sizeof(utf8)) == expected_len);
+    assert(memcmp(utf8, expected, expected_len) == 0);
+}
+
+// Check the path functions against the reference versions for `host`.
+static void check_paths(const char *host) {
+    check_path_fn(host, arf_path_parent, host_parent);
+    check_path_fn(host, arf_path_basename, host_basename);
+
+    // Join each of the names, both into a separate buffer and in place.
+    static const char *const names[] = { "", "x", "\xff", "\xaf/", "é\x80" };
+    for (size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i) {
+        const char *name = names[i];
+        char joined[256];
+        size_t host_len = strlen(host);
+        bool sep = host_len != 0 && host[host_len - 1] != '/';
+        snprintf(joined, sizeof(joined), "%s%s%s", host, sep ? "/" : "", name);
+
+        uint8_t base[256], expected[256], actual[256];
+        size_t base_len = arf_encode((const uint8_t *)host, host_len, base,
+                                     sizeof(base));
+        size_t expected_len = arf_encode((const uint8_t *)joined,
+                                         strlen(joined), expected,
+                                         sizeof(expected));
+        assert(arf_path_join(base, base_len, (const uint8_t *)name,
+                             strlen(name), actual, 0) == expected_len);
+        assert(arf_path_join(base, base_len, (const uint8_t *)name,
+                             strlen(name), actual, sizeof(actual)) ==
+               expected_len);
+        assert(memcmp(actual, expected, expected_len) == 0);
+        assert(arf_path_join(base, base_len, (const uint8_t *)name,
+                             strlen(name), base, sizeof(base)) == expected_len);
+        assert(memcmp(base, expected, expected_len) == 0);
+    }
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+// Write an ARF string for `host` which escapes every non-ASCII byte, even
+// those in valid sequences, into `out`, and return its length. It's valid,
+// but not what `arf_encode` gives unless every such byte needs escaping.
+static size_t escape_every_byte(const char *host, uint8_t *out) {
+    size_t len = strlen(host), lossy_len = sizeof(UTF8_BOM) - 1;
+    size_t escaped_len = 0;
+    uint8_t escaped[256];
+    memcpy(out, UTF8_BOM, lossy_len);
+    for (size_t i = 0; i != len; ++i) {
+        uint8_t b = (uint8_t)host[i];
+        if (b & 0x80) {
+            memcpy(out + lossy_len, UTF8_REPLACEMENT, 3);
+            lossy_len += 3;
+            escaped[escaped_len++] = '\0';
+            escaped[escaped_len++] = b & 0x7f;
+        } else {
+            out[lossy_len++] = b;
+            escaped[escaped_len++] = b;
+        }
+    }
+    out[lossy_len++] = '\0';
+    memcpy(out + lossy_len, escaped, escaped_len);
+    return lossy_len + escaped_len;
+}
+
+// Check that hashing and comparing the UTF-8 forms of host strings `a` and
+// `b` agree with doing so on the host strings themselves.
+static void check_host_order(const char *a, const char *b) {
+    uint8_t a_utf8[256], b_utf8[256];
+    size_t a_len = strlen(a), b_len = strlen(b);
+    size_t a_utf8_len = arf_encode((const uint8_t *)a, a_len, a_utf8,
+                                   sizeof(a_utf8));
+    size_t b_utf8_len = arf_encode((const uint8_t *)b, b_len, b_utf8,
+                                   sizeof(b_utf8));
+
+    assert(arf_hash(7, a_utf8, a_utf8_len) ==
+           arf_hash_host(7, (const uint8_t *)a, a_len));
+    bool equal = strcmp(a, b) == 0;
+    assert(arf_equal(a_utf8, a_utf8_len, b_utf8, b_utf8_len) == equal);
+    assert(arf_equal_host(a_utf8, a_utf8_len, (const uint8_t *)b, b_len) ==
+           equal);
+    int order = sign(strcmp(a, b));
+    assert(sign(arf_compare(a_utf8, a_utf8_len, b_utf8, b_utf8_len)) == order);
+    assert(sign(arf_compare_host(a_utf8, a_utf8_len, (const uint8_t *)b,
+                                 b_len)) == order);
+
+    // So does an ARF string for `a` which escapes bytes it needn't have. ARF
+    // strings must escape something, so there's only one if `a` isn't ASCII.
+    uint8_t a_arf[512];
+    size_t a_arf_len = escape_every_byte(a, a_arf);
+    bool ascii = true;
+    for (size_t i = 0; i != a_len; ++i)
+        ascii &= (a[i] & 0x80) == 0;
+    if (!ascii) {
+        assert(arf_is_valid_arf(a_arf, a_arf_len));
+        assert(arf_equal(a_arf, a_arf_len, a_utf8, a_utf8_len));
+        assert(arf_equal(a_utf8, a_utf8_len, a_arf, a_arf_len));
+        assert(arf_equal(a_arf, a_arf_len, b_utf8, b_utf8_len) == equal);
+        assert(arf_equal(b_utf8, b_utf8_len, a_arf, a_arf_len) == equal);
+        assert(arf_hash(7, a_arf, a_arf_len) ==
+               arf_hash(7, a_utf8, a_utf8_len));
+        assert(sign(arf_compare(a_arf, a_arf_len, b_utf8, b_utf8_len)) ==
+               order);
+    }
+
+    // Views agree with the functions on the UTF-8 forms.
+    struct arf_view a_view, b_view;
+    assert(arf_view_init(&a_view, a_utf8, a_utf8_len) == ARF_OK);
+    assert(arf_view_init(&b_view, b_utf8, b_utf8_len) == ARF_OK);
+    assert(a_view.host_len == a_len);
+    assert((a_view.escapes == 0) == arf_is_valid_c_str(a));
+    assert(arf_view_hash(7, &a_view) == arf_hash(7, a_utf8, a_utf8_len));
+    assert(sign(arf_view_compare(&a_view, &b_view)) == order);
+    char view_host[256];
+    arf_view_c_str(&a_view, view_host);
+    assert(strcmp(view_host, a) == 0);
+    size_t lossy_len;
+    const uint8_t *lossy = arf_view_lossy(&a_view, &lossy_len);
+    assert(memchr(lossy, '\0', lossy_len) == NULL);
+    assert(arf_is_valid_arf(a_utf8, a_utf8_len) == (a_view.escapes != 0));
+
+    // Streaming in pieces doesn't change the hash.
+    struct arf_hasher hasher;
+    arf_hasher_init(&hasher, 7);
+    for (size_t i = 0; i != a_len; ++i)
+        arf_hasher_update(&hasher, (const uint8_t *)a + i, 1);
+    assert(arf_hasher_finish(&hasher) ==
+           arf_hash_host(7, (const uint8_t *)a, a_len));
+    arf_hasher_update_utf8(&hasher, b_utf8, b_utf8_len);
+    char ab[512];
+    snprintf(ab, sizeof(ab), "%s%s", a, b);
+    assert(arf_hasher_finish(&hasher) ==
+           arf_hash_host(7, (const uint8_t *)ab, a_len + b_len));
+}
+
+#ifdef __linux__
+// Encode an invalid string on another thread, whose counters outlive it.
+static void *stats_thread(void *arg) {
+    (void)arg;
+    uint8_t buf[16];
+    assert(arf_encode(ptr_len("\xff"), buf, sizeof(buf)) == 9);
+    return NULL;
+}
+#endif
+
+// Convert `host` both ways through `cache`, and check that the results are
+// what `arf_encode` and `arf_decode` give.
+static void check_cache(struct arf_cache *cache, const char *host) {
+    uint8_t expected[256], utf8[256];
+    char c_str[256];
+    size_t len = strlen(host), size;
+    size_t utf8_len = arf_encode((const uint8_t *)host, len, expected,
+                                 sizeof(expected));
+
+    // Decoding an ARF string which escapes every non-ASCII byte, even those
+    // in valid sequences, mustn't make encoding return it.
+    size_t arf_len = escape_every_byte(host, utf8);
+    if (arf_len != utf8_len && arf_is_valid_arf(utf8, arf_len)) {
+        assert(arf_cache_decode(cache, utf8, arf_len, c_str,
+                                sizeof(c_str), &size) == ARF_OK);
+        assert(size == len + 1 && strcmp(c_str, host) == 0);
+    }
+
+    assert(arf_cache_encode(cache, (const uint8_t *)host, len, utf8,
+                            sizeof(utf8)) == utf8_len);
+    assert(memcmp(utf8, expected, utf8_len) == 0);
+    assert(arf_cache_encode(cache, (const uint8_t *)host, len, NULL, 0) ==
+           utf8_len);
+    assert(arf_cache_decode(cache, utf8, utf8_len, c_str, sizeof(c_str),
+                            &size) == ARF_OK);
+    assert(size == len + 1 && strcmp(c_str, host) == 0);
+    assert(arf_cache_decode(cache, utf8, utf8_len, c_str, len, &size) ==
+           ARF_TOO_SMALL);
+    assert(size == len + 1);
+}
+
+#ifdef __linux__
+// Convert assorted strings through a shared cache.
+static void *cache_thread(void *arg) {
+    struct arf_cache *cache = arg;
+    char host[32];
+    for (int i = 0; i != 2000; ++i) {
+        snprintf(host, sizeof(host), "dir\xe9/%d\xff", (i * 7919) % 97);
+        check_cache(cache, host);
+    }
+    return NULL;
+}
+#endif
+
 int main(void) {
     assert(arf_is_valid_c_str(""));
     assert(arf_is_valid_c_str("foo"));
@@ -201,6 +749,26 @@ int main(void) {
     assert(!arf_is_valid_c_str("\xff"));
     assert(!arf_is_valid_c_str("\xff\xfe"));
 
+    check_embedded("");
+    check_embedded("\xc2\x80");
+    check_embedded("\xe4\xb8\xad");
+    check_embedded("\xf0\x9f\x90\xb0");
+    check_embedded(UTF8_REPLACEMENT);
+    check_embedded("\xef\xbf\xbe");
+    check_embedded("\xef\xbf\xbf");
+    check_embedded("\xed\xa0\x80");
+    check_embedded("\xe0\x80\x80");
+    check_embedded("\xf4\x90\x80\x80");
+    check_embedded("\xf0\x8f\xbf\xbf");
+    check_embedded("\xf5\x80\x80\x80");
+    check_embedded("\xf0\x90\x90");
+    check_embedded("\xe1\x80");
+    check_embedded("\xc0\x80");
+    check_embedded("\xc2");
+    check_embedded("\x80");
+    check_embedded("\xff\xfe");
+    check_kernels_random();
+
     assert(!arf_has_arf_magic(ptr_len("")));
     assert(!arf_has_arf_magic(ptr_len("f")));
     assert(!arf_has_arf_magic(ptr_len("foo")));
@@ -224,6 +792,9 @@ int main(void) {
     assert(!arf_is_valid_arf(ptr_len(UTF8_BOM "foo\xef\xbf\xbc" "\0" "foo\0\x7F")));
     assert(!arf_is_valid_arf(ptr_len(UTF8_REPLACEMENT "foo�" "\0" UTF8_REPLACEMENT "foo\0\x7F")));
     assert(!arf_is_valid_arf(ptr_len(UTF8_REPLACEMENT UTF8_BOM "foo�" "\0" UTF8_REPLACEMENT "foo\0\x7F")));
+    assert(!arf_is_valid_arf(ptr_len(UTF8_BOM "foo�" "\0" "fo")));
+    assert(!arf_is_valid_arf(ptr_len(UTF8_BOM "foo�" "\0" "foo\0\x7F" "bar")));
+    assert(!arf_is_valid_arf(ptr_len(UTF8_BOM "foo�" "\0" "foo\0\x7F" "\0\x7F")));
     assert(arf_is_valid_arf(ptr_len(UTF8_BOM "foo\xef\xbf\xbd" "\0" "foo\0\x7F")));
     assert(arf_is_valid_arf(ptr_len(UTF8_BOM "foo�" "\0" "foo\0\x7F")));
     assert(arf_is_valid_arf(ptr_len(UTF8_BOM "�foo���bar�" "\0" "\0\x7F" "foo\0\x7F\0\x7E\0\x7D" "bar\0\x7C")));
@@ -280,6 +851,46 @@ int main(void) {
     arf_c_str_arf("\xe6\x96", buffer);
     assert(memcmp(buffer, ptr_len(UTF8_BOM "��\0" "\0f" "\0\x16")) == 0);
 
+    assert(arf_encode(ptr_len(""), NULL, 0) == 0);
+    assert(arf_encode(ptr_len("foo"), NULL, 0) == 3);
+    assert(arf_encode(ptr_len("foo\xff"), NULL, 0) == 15);
+    assert(arf_encode(ptr_len("foo\xff" "bar\xfe"), buffer, 25) == 26);
+
+    memset(buffer, '#', sizeof(buffer));
+    assert(arf_encode(ptr_len("foo"), buffer, 3) == 3);
+    assert(memcmp(buffer, "foo#", 4) == 0);
+
+    assert(arf_encode(ptr_len(UTF8_BOM "foo"), buffer, sizeof(buffer)) == 6);
+    assert(memcmp(buffer, ptr_len(UTF8_BOM "foo")) == 0);
+
+    memset(buffer, '#', sizeof(buffer));
+    assert(arf_encode(ptr_len("foo\xff" "bar\xfe"), buffer, 26) == 26);
+    assert(memcmp(buffer, ptr_len(UTF8_BOM "foo�bar�\0" "foo\0\x7F" "bar\0\x7E" "#")) == 0);
+
+    assert(arf_encode(ptr_len("\xe6\x96"), buffer, sizeof(buffer)) == 14);
+    assert(memcmp(buffer, ptr_len(UTF8_BOM "��\0" "\0f" "\0\x16")) == 0);
+
+    assert(arf_encode(ptr_len(UTF8_REPLACEMENT "foo\xff" "bar\xfe" "end"), buffer, sizeof(buffer)) == 38);
+    assert(memcmp(buffer, ptr_len(UTF8_BOM UTF8_REPLACEMENT "foo�bar�end\0" UTF8_REPLACEMENT "foo\0\x7F" "bar\0\x7E" "end")) == 0);
+
+    const char *const no_strs[] = { NULL };
+    size_t count;
+    size_t offsets[4];
+
+    assert(arf_sizeof_c_strs_arf(no_strs, &count) == 0);
+    assert(count == 0);
+
+    const char *const strs[] = { "foo", "foo\xff", "", UTF8_BOM, NULL };
+    assert(arf_sizeof_c_strs_arf(strs, &count) == 4 + 16 + 1 + 4);
+    assert(count == 4);
+
+    arf_c_strs_arf(strs, buffer, offsets);
+    assert(memcmp(buffer, ptr_len("foo\0" UTF8_BOM "foo�\0" "foo\0\x7F" "\0" "\0" UTF8_BOM "\0")) == 0);
+    assert(offsets[0] == 0);
+    assert(offsets[1] == 4);
+    assert(offsets[2] == 20);
+    assert(offsets[3] == 21);
+
     assert(arf_sizeof_arf_c_str(ptr_len(UTF8_BOM "�\0" "\0\x7F")) == 2);
     assert(arf_sizeof_arf_c_str(ptr_len(UTF8_BOM "foo�\0" "foo\0\x7F")) == 5);
     assert(arf_sizeof_arf_c_str(ptr_len(UTF8_BOM "foo�bar�\0" "foo\0\x7F" "bar\0\x7E")) == 9);
@@ -297,5 +908,342 @@ int main(void) {
     arf_arf_c_str(ptr_len(UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end"), (char *)buffer);
     assert(strcmp((const char *)buffer, "foo\xff" "bar\xfe" "end") == 0);
 
+    size_t size;
+
+    assert(arf_decode(ptr_len(""), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 1 && buffer[0] == '\0');
+
+    assert(arf_decode(ptr_len("foo"), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 4 && strcmp((const char *)buffer, "foo") == 0);
+
+    assert(arf_decode(ptr_len(UTF8_BOM "foo"), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 7 && strcmp((const char *)buffer, UTF8_BOM "foo") == 0);
+
+    assert(arf_decode(ptr_len("foo"), (char *)buffer, 3, &size) == ARF_TOO_SMALL);
+    assert(size == 4);
+
+    assert(arf_decode(ptr_len("foo"), NULL, 0, &size) == ARF_TOO_SMALL);
+    assert(size == 4);
+
+    assert(arf_decode(ptr_len("foo\xff"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+    assert(arf_decode(ptr_len("foo\0bar"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+    assert(arf_decode(ptr_len(UTF8_BOM "foo" "\0" "foo"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+    assert(arf_decode(ptr_len(UTF8_BOM "foo�" "\0" "foo\0\x80"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+    assert(arf_decode(ptr_len(UTF8_BOM "foo�" "\0" "goo\0\x7F"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+    assert(arf_decode(ptr_len(UTF8_BOM "foo�" "\0" "foo\0\x7F" "x"), (char *)buffer, sizeof(buffer), &size) == ARF_INVALID);
+
+    assert(arf_decode(ptr_len(UTF8_BOM "�\0" "\0\x7F"), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 2 && strcmp((const char *)buffer, "\xff") == 0);
+
+    assert(arf_decode(ptr_len(UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end"), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 12 && strcmp((const char *)buffer, "foo\xff" "bar\xfe" "end") == 0);
+
+    assert(arf_decode(ptr_len(UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end"), (char *)buffer, 11, &size) == ARF_TOO_SMALL);
+    assert(size == 12);
+
+    assert(arf_decode(ptr_len(UTF8_BOM "��\0" "\0\0" "\0\x7F"), (char *)buffer, sizeof(buffer), &size) == ARF_OK);
+    assert(size == 3 && memcmp(buffer, "\x80\xff", 3) == 0);
+
+    assert(arf_decode_trusted(ptr_len(""), (char *)buffer) == 1);
+    assert(buffer[0] == '\0');
+    assert(arf_decode_trusted(ptr_len("foo"), (char *)buffer) == 4);
+    assert(strcmp((char *)buffer, "foo") == 0);
+    assert(arf_decode_trusted(ptr_len(UTF8_BOM "�\0" "\0\x7F"), (char *)buffer) == 2);
+    assert(strcmp((char *)buffer, "\xff") == 0);
+    assert(arf_decode_trusted(ptr_len(UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end"), (char *)buffer) == 12);
+    assert(strcmp((char *)buffer, "foo\xff" "bar\xfe" "end") == 0);
+    assert(arf_decode_trusted(ptr_len(UTF8_BOM "��\0" "\0\0" "\0\x7F"), (char *)buffer) == 3);
+    assert(memcmp(buffer, "\x80\xff", 3) == 0);
+
+    memcpy(buffer, "foo", 3);
+    assert(arf_decode_in_place(buffer, 3, 4, &size) == ARF_OK);
+    assert(size == 4 && strcmp((const char *)buffer, "foo") == 0);
+    memcpy(buffer, "foo", 3);
+    assert(arf_decode_in_place(buffer, 3, 3, &size) == ARF_TOO_SMALL);
+    assert(size == 4);
+    memcpy(buffer, "foo\xff", 4);
+    assert(arf_decode_in_place(buffer, 4, 5, &size) == ARF_INVALID);
+    static const char in_place[] = UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end";
+    memcpy(buffer, in_place, sizeof(in_place) - 1);
+    assert(arf_decode_in_place(buffer, sizeof(in_place) - 1, sizeof(in_place) - 1, &size) == ARF_OK);
+    assert(size == 12 && strcmp((const char *)buffer, "foo\xff" "bar\xfe" "end") == 0);
+    static const char in_place_invalid[] = UTF8_BOM "foo�" "\0" "goo\0\x7F";
+    memcpy(buffer, in_place_invalid, sizeof(in_place_invalid) - 1);
+    assert(arf_decode_in_place(buffer, sizeof(in_place_invalid) - 1, sizeof(in_place_invalid) - 1, &size) == ARF_INVALID);
+
+    struct arf_view view;
+    assert(arf_view_init(&view, ptr_len(UTF8_BOM "foo�bar�end\0" "foo\0\x7F" "bar\0\x7E" "end")) == ARF_OK);
+    assert(view.nul == 18 && view.escapes == 2 && view.host_len == 11);
+    size_t lossy_len;
+    const uint8_t *lossy = arf_view_lossy(&view, &lossy_len);
+    assert(lossy_len == 15 && memcmp(lossy, "foo�bar�end", 15) == 0);
+    assert(arf_view_init(&view, ptr_len("foo")) == ARF_OK);
+    assert(view.nul == 3 && view.escapes == 0 && view.host_len == 3);
+    assert(arf_view_init(&view, ptr_len("foo\xff")) == ARF_INVALID);
+    assert(arf_view_init(&view, ptr_len(UTF8_BOM "foo�" "\0" "goo\0\x7F")) == ARF_INVALID);
+
+    struct arf_arena arena;
+    const uint8_t *out;
+    const char *c_str;
+
+    arf_arena_init(&arena);
+    arf_arena_reset(&arena);
+
+    static const uint8_t foo[] = "foo";
+    assert(arf_encode_in(&arena, foo, 3, &out, &len) == ARF_OK);
+    assert(out == foo && len == 3);
+
+    assert(arf_encode_in(&arena, ptr_len("foo\xff"), &out, &len) == ARF_OK);
+    assert(len == 15 && memcmp(out, ptr_len(UTF8_BOM "foo�\0" "foo\0\x7F")) == 0);
+
+    assert(arf_decode_in(&arena, out, len, &c_str, &size) == ARF_OK);
+    assert(size == 5 && strcmp(c_str, "foo\xff") == 0);
+
+    assert(arf_decode_in(&arena, ptr_len("foo"), &c_str, &size) == ARF_OK);
+    assert(size == 4 && strcmp(c_str, "foo") == 0);
+
+    assert(arf_decode_in(&arena, ptr_len("foo\xff"), &c_str, &size) == ARF_INVALID);
+
+    // Spill over into more chunks, including ones bigger than the default.
+    static uint8_t big[100000];
+    memset(big, 0xff, sizeof(big));
+    for (int i = 0; i != 3; ++i) {
+        for (int j = 0; j != 10000; ++j) {
+            assert(arf_encode_in(&arena, ptr_len("foo\xff"), &out, &len) == ARF_OK);
+            assert(len == 15 && memcmp(out, ptr_len(UTF8_BOM "foo�\0" "foo\0\x7F")) == 0);
+        }
+        assert(arf_encode_in(&arena, big, sizeof(big), &out, &len) == ARF_OK);
+        assert(len == 4 + 5 * sizeof(big));
+        assert(arf_decode_in(&arena, out, len, &c_str, &size) == ARF_OK);
+        assert(size == sizeof(big) + 1 && memcmp(c_str, big, sizeof(big)) == 0);
+        arf_arena_reset(&arena);
+    }
+
+    arf_arena_destroy(&arena);
+
+#ifdef __linux__
+    check_dir(4096);
+    check_dir(64);
+#endif
+
+    check_streaming("");
+    check_streaming("foo");
+    check_streaming("foo\xff");
+    check_streaming("\xff");
+    check_streaming("\xff\xfe\xfd");
+    check_streaming("\xc2\x80\xe4\xb8\xad\xf0\x9f\x90\xb0");
+    check_streaming("a\xc2");
+    check_streaming("a\xe4\xb8");
+    check_streaming("a\xf0\x9f\x90");
+    check_streaming("\xe0\x41\xf0\x9f\x41");
+    check_streaming("\xf0\xf0\x9f\x90\xb0\x9f");
+    check_streaming("\xe4\xb8\xe4\xb8\xad\xb8");
+    check_streaming("\xef\xbf\xbe\xef\xbf\xbd\xed\xa0\x80");
+    check_streaming("\xc0\x80\xf4\x90\x80\x80\xf5");
+    check_streaming(UTF8_BOM "foo\xff" UTF8_REPLACEMENT "\x80");
+
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo\0" "foo")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo\xff\0" "foo\0\x7F")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�\0" "foo\0\x7F")) == ARF_OK);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�\0" "foo\0")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�\0" "foo\0\x7F" "x")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�\0" "fo\0\x7F")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�\0" "foo\0\xFF")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "foo�")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "\0" "\0\x7F")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len(UTF8_BOM "\0" "a")) == ARF_INVALID);
+    assert(decode_streaming(ptr_len("\xef\xbb\xbe" "foo�\0" "foo\0\x7F")) == ARF_INVALID);
+
+    static const uint16_t lone_high[] = { 0xd800 };
+    check_utf16(lone_high, 1, ptr_len(UTF8_BOM UTF8_REPLACEMENT "\0\0\0"));
+    static const uint16_t lone_low[] = { 0xdfff };
+    check_utf16(lone_low, 1, ptr_len(UTF8_BOM UTF8_REPLACEMENT "\0\0\xdf\xbf"));
+    static const uint16_t between[] = { 0x47, 0xd800, 0x48 };
+    check_utf16(between, 3, ptr_len(UTF8_BOM "G" UTF8_REPLACEMENT "H\0G\0\0H"));
+    static const uint16_t reversed[] = { 0xdc00, 0xd800 };
+    check_utf16(reversed, 2, ptr_len(UTF8_BOM UTF8_REPLACEMENT UTF8_REPLACEMENT
+                                     "\0\0\xd0\x80\0\0"));
+    static const uint16_t paired[] = { 0x66, 0xd83d, 0xdc30, 0x6f };
+    check_utf16(paired, 4, ptr_len("f\xf0\x9f\x90\xb0o"));
+    static const uint16_t noncharacter[] = { 0xfffe, 0xd801 };
+    check_utf16(noncharacter, 2, ptr_len(UTF8_BOM "\xef\xbf\xbe" UTF8_REPLACEMENT
+                                         "\0\xef\xbf\xbe\0\x01"));
+    static const uint16_t empty[] = { 0 };
+    check_utf16(empty, 0, ptr_len(""));
+
+    uint16_t wide[32];
+    size_t wide_size;
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM "hello" UTF8_REPLACEMENT "world\0hello\0\x05world"),
+                            wide, 32, &wide_size) == ARF_OK);
+    assert(wide_size == 12 && wide[5] == 0xd805 && wide[6] == 'w');
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM "hello world\0hello world"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM "hello world\0\0hello world\0"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM "hello" UTF8_REPLACEMENT "world\0\0hello\0\x05world\0"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len("\xef\xbf\xbe" "hello" UTF8_REPLACEMENT "world\0hello\0\x05world"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM "hello" UTF8_REPLACEMENT "\0hello\0"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len(UTF8_BOM UTF8_REPLACEMENT "\0\0\xe0\xa0\x80"),
+                            wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len("\xfe"), wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len("\xc0\xff"), wide, 32, &wide_size) == ARF_INVALID);
+    assert(arf_decode_utf16(ptr_len("\xed\xa0\x80"), wide, 32, &wide_size) == ARF_INVALID);
+
+    // Every path of up to four pieces, where slashes, escaped bytes which are
+    // slashes, and literal U+FFFD may confuse the correspondence between the
+    // two portions.
+    static const char *const pieces[] = { "a", "/", "\xff", "\xaf", "\x80",
+                                          UTF8_REPLACEMENT };
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    char prev[64] = "";
+    for (size_t n = 0, count = 1; n <= 4; ++n, count *= piece_count) {
+        for (size_t i = 0; i != count; ++i) {
+            char host[64] = "";
+            for (size_t j = 0, k = i; j != n; ++j, k /= piece_count)
+                strcat(host, pieces[k % piece_count]);
+            check_paths(host);
+            check_host_order(host, host);
+            check_host_order(host, prev);
+            check_host_order(prev, host);
+            strcpy(prev, host);
+        }
+    }
+
+    // Bases with a NUL too early to follow an ARF string's BOM.
+    uint8_t joined[16];
+    assert(arf_path_join(ptr_len("a\0b"), ptr_len("c"), joined,
+                         sizeof(joined)) == SIZE_MAX);
+    assert(arf_path_join(ptr_len("\0"), ptr_len("\xff"), joined,
+                         sizeof(joined)) == SIZE_MAX);
+    assert(arf_path_join(ptr_len("\xef\xbb\0\0"), ptr_len("c"), joined,
+                         sizeof(joined)) == SIZE_MAX);
+
+    // XXH64 test vectors.
+    uint8_t hash_input[100];
+    for (size_t i = 0; i != sizeof(hash_input); ++i)
+        hash_input[i] = (uint8_t)(i * 7 + 3);
+    assert(arf_hash_host(0, hash_input, 0) == 0xef46db3751d8e999);
+    assert(arf_hash_host(0, ptr_len("a")) == 0xd24ec4f1a98c6e5b);
+    assert(arf_hash_host(0, ptr_len("abc")) == 0x44bc2cf5ad770999);
+    assert(arf_hash_host(42, ptr_len("abc")) == 0x13c1d910702770e6);
+    assert(arf_hash_host(0, hash_input, 100) == 0xa61f8d4c170fe531);
+    assert(arf_hash_host(42, hash_input, 100) == 0x7dd00be8513c25a2);
+    char long_host[64];
+    memset(long_host, '\xff', 40);
+    strcpy(long_host + 40, "ab");
+    check_host_order(long_host, "\xff\xff");
+    check_host_order("\xff\xff", long_host);
+
+    // Invalid bytes on both sides of a word boundary of the bitmap.
+    check_scan(long_host);
+    char scan_host[91];
+    memset(scan_host, 'a', 90);
+    scan_host[90] = '\0';
+    scan_host[0] = scan_host[63] = scan_host[64] = scan_host[89] = '\xe9';
+    check_scan(scan_host);
+    check_scan("a\xe9" "b\xe9" "c\xe9" "d\xe9" "e\xe9" "f\xe9" "g\xe9" "h\xe9"
+               "i\xe9" "j\xe9" "k\xe9" "l\xe9" "m\xe9" "n\xe9" "o\xe9" "p\xe9"
+               "q\xe9" "r\xe9" "\xc3\xa9\xe9\xf0\x9f");
+
+    // Conversion caches.
+    struct arf_cache cache;
+    struct arf_cache_stats cache_stats;
+    assert(arf_cache_init(&cache, 4096));
+    check_cache(&cache, "foo");
+    check_cache(&cache, "");
+    arf_cache_get_stats(&cache, &cache_stats);
+    assert(cache_stats.hits == 0 && cache_stats.misses == 0 &&
+           cache_stats.entries == 0);
+    check_cache(&cache, "foo\xff");
+    arf_cache_get_stats(&cache, &cache_stats);
+    assert(cache_stats.misses == 1 && cache_stats.insertions == 1);
+    assert(cache_stats.hits == 3 && cache_stats.entries == 1);
+    char cache_host[32];
+    size_t cache_size;
+    assert(arf_cache_decode(&cache, ptr_len(UTF8_BOM "foo�" "\0" "goo\0\x7F"),
+                            cache_host, sizeof(cache_host),
+                            &cache_size) == ARF_INVALID);
+    assert(arf_cache_decode(&cache, ptr_len("foo\xff"), cache_host,
+                            sizeof(cache_host), &cache_size) == ARF_INVALID);
+    for (int i = 0; i != 200; ++i) {
+        snprintf(cache_host, sizeof(cache_host), "%d\xfe%d", i, i);
+        check_cache(&cache, cache_host);
+        arf_cache_get_stats(&cache, &cache_stats);
+        assert(cache_stats.bytes <= 4096);
+    }
+    assert(cache_stats.evictions > 0);
+    assert(cache_stats.insertions == cache_stats.entries + cache_stats.evictions);
+    check_cache(&cache, "\xc3\x80\xff");
+    check_cache(&cache, "caf\xc3\xa9/r\xe9sum\xe9");
+    // Nor does decoding one into plain UTF-8 cache it.
+    arf_cache_get_stats(&cache, &cache_stats);
+    uint64_t cache_insertions = cache_stats.insertions;
+    check_cache(&cache, "caf\xc3\xa9");
+    arf_cache_get_stats(&cache, &cache_stats);
+    assert(cache_stats.insertions == cache_insertions);
+    arf_cache_destroy(&cache);
+
+    assert(arf_cache_init(&cache, 0));
+    check_cache(&cache, "foo\xff");
+    arf_cache_get_stats(&cache, &cache_stats);
+    assert(cache_stats.entries == 0);
+    arf_cache_destroy(&cache);
+
+#ifdef __linux__
+    assert(arf_cache_init(&cache, 8192));
+    pthread_t cache_threads[4];
+    for (size_t i = 0; i != 4; ++i)
+        assert(pthread_create(&cache_threads[i], NULL, cache_thread, &cache) == 0);
+    for (size_t i = 0; i != 4; ++i)
+        assert(pthread_join(cache_threads[i], NULL) == 0);
+    arf_cache_get_stats(&cache, &cache_stats);
+    assert(cache_stats.hits + cache_stats.misses == 4 * 2000 * 4);
+    assert(cache_stats.bytes <= 8192);
+    arf_cache_destroy(&cache);
+#endif
+
+    // Conversion statistics, if the library counts them.
+    struct arf_stats stats;
+    arf_stats_reset();
+    if (arf_stats_get(&stats)) {
+        assert(stats.calls == 0 && stats.arf_encodes == 0);
+        uint8_t stats_buf[32];
+        size_t stats_size;
+        assert(arf_encode(ptr_len("foo"), stats_buf, sizeof(stats_buf)) == 3);
+        assert(arf_encode(ptr_len("a\xff\xfe"), stats_buf,
+                          sizeof(stats_buf)) == 16);
+        char stats_c_str[32];
+        assert(arf_decode(stats_buf, 16, stats_c_str, sizeof(stats_c_str),
+                          &stats_size) == ARF_OK);
+        assert(arf_decode(ptr_len("\xff"), stats_c_str, sizeof(stats_c_str),
+                          &stats_size) == ARF_INVALID);
+        assert(arf_stats_get(&stats));
+        assert(stats.calls == 4);
+        assert(stats.fast_path == 1);
+        assert(stats.bytes_scanned >= 3 + 3);
+        assert(stats.invalid_bytes == 2);
+        assert(stats.arf_encodes == 1);
+        assert(stats.arf_decodes == 1);
+        assert(stats.validation_failures == 1);
+
+#ifdef __linux__
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, stats_thread, NULL) == 0);
+        assert(pthread_join(thread, NULL) == 0);
+        assert(arf_stats_get(&stats));
+        assert(stats.calls == 5 && stats.arf_encodes == 2);
+        assert(stats.invalid_bytes == 3);
+#endif
+
+        arf_stats_reset();
+        assert(arf_stats_get(&stats));
+        assert(stats.calls == 0 && stats.invalid_bytes == 0);
+    } else {
+        assert(stats.calls == 0 && stats.fast_path == 0 &&
+               stats.bytes_scanned == 0 && stats.arf_encodes == 0);
+    }
     return 0;
 }
@@ -0,0 +1,160 @@
+#undef NDEBUG
+#include "arf.hpp"
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#define UTF8_BOM "\xef\xbb\xbf"
+#define UTF8_REPLACEMENT "\xef\xbf\xbd"
+
+using namespace std::literals;
+
+// An allocator which counts the allocations made through it.
+static std::size_t allocations = 0;
+
+template <class T> struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator() = default;
+    template <class U> counting_allocator(const counting_allocator<U> &) {}
+
+    T *allocate(std::size_t n) {
+        ++allocations;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, std::size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    bool operator==(const counting_allocator &) const { return true; }
+    bool operator!=(const counting_allocator &) const { return false; }
+};
+
+// Compile-time conversions.
+static_assert(arf::encoded_size("") == 0);
+static_assert(arf::encoded_size("foo") == 3);
+static_assert(arf::encoded_size("foo\xff") == 15);
+static_assert(arf::decoded_size("foo") == 3);
+static_assert(arf::decoded_size(UTF8_BOM "foo" UTF8_REPLACEMENT "\0" "foo\0\x7f"sv) == 4);
+static_assert(arf::decoded_size(UTF8_BOM "foo\0" "foo"sv) == arf::npos);
+static_assert(arf::decoded_size("\xef\xbf\xbe") == arf::npos);
+
+constexpr auto encoded = ARF_LITERAL("foo\xff");
+static_assert(encoded.view() == UTF8_BOM "foo" UTF8_REPLACEMENT "\0" "foo\0\x7f"sv);
+constexpr auto plain = ARF_LITERAL("foo");
+static_assert(plain.view() == "foo"sv);
+constexpr auto host = ARF_HOST_LITERAL(UTF8_BOM "a" UTF8_REPLACEMENT "b\0" "a\0\x7e" "b");
+static_assert(host.view() == "a\xfe" "b"sv);
+
+// Check that the compile-time implementation agrees with the C library.
+static void check_constexpr(std::string_view c_str) {
+    char expected[256], actual[256];
+    std::size_t size = arf_encode(arf::detail::bytes(c_str), c_str.size(),
+                                  reinterpret_cast<std::uint8_t *>(expected),
+                                  sizeof(expected));
+    assert(arf::detail::encode(c_str, actual) == size);
+    assert(std::memcmp(expected, actual, size) == 0);
+    assert(arf::detail::is_valid_utf8(c_str) == (size == c_str.size()));
+
+    std::string_view utf8(expected, size);
+    std::size_t host_size;
+    assert(arf_decode(arf::detail::bytes(utf8), utf8.size(), expected, 0,
+                      &host_size) == ARF_TOO_SMALL);
+    assert(arf::detail::decode(utf8, actual) == c_str.size());
+    assert(std::memcmp(actual, c_str.data(), c_str.size()) == 0);
+
+    // Corrupt each byte in turn, and check that both agree on validity.
+    char corrupt[256];
+    for (std::size_t i = 0; i != size; ++i) {
+        for (int delta : {1, 0x40, 0x80}) {
+            std::memcpy(corrupt, expected, size);
+            corrupt[i] = static_cast<char>(corrupt[i] + delta);
+            std::string_view s(corrupt, size);
+            assert((arf::detail::decode(s, nullptr) == arf::npos) ==
+                   (arf::decoded_size(s) == arf::npos));
+        }
+    }
+}
+
+int main() {
+    check_constexpr("");
+    check_constexpr("foo");
+    check_constexpr("foo\xff");
+    check_constexpr("\xff\xfe\xfd");
+    check_constexpr("\xc2\x80\xe4\xb8\xad\xf0\x9f\x90\xb0");
+    check_constexpr("a\xe4\xb8" "b\xf0\x9f\x90");
+    check_constexpr("\xef\xbf\xbe\xef\xbf\xbd\xed\xa0\x80");
+    check_constexpr("\xc0\x80\xf4\x90\x80\x80\xf5");
+    check_constexpr(UTF8_BOM "foo\xff" UTF8_REPLACEMENT "\x80");
+
+    // Runtime versions of the compile-time functions.
+    assert(arf::is_valid_utf8("foo"));
+    assert(!arf::is_valid_utf8("foo\xff"));
+    assert(arf::encoded_size("foo\xff"sv) == 15);
+    assert(arf::decoded_size(encoded) == 4);
+    assert(arf::decoded_size("foo\xff"sv) == arf::npos);
+    assert(arf::is_arf(encoded));
+    assert(!arf::is_arf("foo"));
+
+    // Conversions into std::string reuse its capacity.
+    std::string s;
+    assert(arf::encode("foo\xff", s) == ARF_OK);
+    assert(s == encoded.view());
+    assert(arf::encode("bar", s) == ARF_OK);
+    assert(s == "bar");
+    assert(arf::decode(encoded, s) == ARF_OK);
+    assert(s == "foo\xff");
+    assert(arf::decode("foo\xff", s) == ARF_INVALID);
+    assert(s.empty());
+    assert(arf::decode(std::string(1000, 'x'), s) == ARF_OK);
+    assert(s == std::string(1000, 'x'));
+
+    using counting_string =
+        std::basic_string<char, std::char_traits<char>, counting_allocator<char>>;
+    counting_string cs;
+    cs.reserve(100);
+    allocations = 0;
+    for (int i = 0; i != 100; ++i) {
+        assert(arf::encode("foo\xff", cs) == ARF_OK);
+        assert(std::string_view(cs) == encoded.view());
+        assert(arf::decode(encoded, cs) == ARF_OK);
+        assert(std::string_view(cs) == "foo\xff");
+    }
+    assert(allocations == 0);
+
+    // Host paths are stored inline when they fit.
+    arf::basic_host_path<384, counting_allocator<char>> path;
+    assert(path.empty() && std::strcmp(path.c_str(), "") == 0);
+    allocations = 0;
+    assert(arf::decode(encoded, path) == ARF_OK);
+    assert(path.view() == "foo\xff" && path.c_str()[4] == '\0');
+    assert(arf::decode(std::string(383, 'x'), path) == ARF_OK);
+    assert(path.size() == 383);
+    assert(allocations == 0);
+
+    assert(arf::decode(std::string(384, 'y'), path) == ARF_OK);
+    assert(path.view() == std::string(384, 'y'));
+    assert(allocations == 1);
+
+    // Copies and moves, both inline and not.
+    auto copy = path;
+    assert(copy.view() == path.view() && copy.c_str() != path.c_str());
+    auto moved = std::move(copy);
+    assert(moved.view() == path.view() && copy.empty());
+    assert(arf::decode("short", path) == ARF_OK);
+    moved = path;
+    assert(moved.view() == "short");
+    arf::host_path small;
+    assert(arf::decode("inline", small) == ARF_OK);
+    arf::host_path small_moved = std::move(small);
+    assert(small_moved.view() == "inline" && small.empty());
+
+    assert(arf::decode(UTF8_BOM "foo\0" "foo"sv, path) == ARF_INVALID);
+    assert(path.empty() && path.c_str()[0] == '\0');
+
+    arf::decode_trusted(encoded, path);
+    assert(path.view() == "foo\xff");
+    arf::decode_trusted("plain", path);
+    assert(path.view() == "plain");
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#undef NDEBUG
+#define _GNU_SOURCE
+#include "arf_preload.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define UTF8_BOM "\xef\xbb\xbf"
+#define UTF8_REPLACEMENT "\xef\xbf\xbd"
+
+// The ARF string for `c_str`, in a static buffer so that nothing else follows
+// it in memory but zeros, as a worst case for reading past it.
+static const char *arf(const char *c_str) {
+    static char bufs[4][256];
+    static size_t next = 0;
+    char *buf = bufs[next++ % 4];
+    memset(buf, 0, sizeof(bufs[0]));
+    assert(arf_encode((const uint8_t *)c_str, strlen(c_str), (uint8_t *)buf,
+                      sizeof(bufs[0]) - 1) < sizeof(bufs[0]));
+    return buf;
+}
+
+// Whether the directory `dir` has an entry named `name`.
+static bool has_entry(const char *dir, const char *name) {
+    DIR *d = opendir(dir);
+    assert(d != NULL);
+    bool found = false;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+        found |= strcmp(ent->d_name, name) == 0;
+    closedir(d);
+    return found;
+}
+
+int main(void) {
+    char buf[PATH_MAX];
+
+    // Plain paths, and paths which only look like ARF strings, pass through.
+    const char *plain = "foo";
+    assert(arf_preload_host_path(plain, buf, sizeof(buf)) == plain);
+    const char *bom = UTF8_BOM "foo";
+    assert(arf_preload_host_path(bom, buf, sizeof(buf)) == bom);
+    static const char fake[] = UTF8_BOM "foo" UTF8_REPLACEMENT "\0fob\0\x7f";
+    assert(arf_preload_host_path(fake, buf, sizeof(buf)) == fake);
+    static const char literal[] =
+        UTF8_BOM UTF8_REPLACEMENT "\0" UTF8_REPLACEMENT;
+    assert(arf_preload_host_path(literal, buf, sizeof(buf)) == literal);
+
+    // With their lengths, plain paths which look like ARF strings aren't read
+    // past their ends. This one is on the heap, so ASan would catch it.
+    static const char looks_arf[] = UTF8_BOM "ab" UTF8_REPLACEMENT "c";
+    char *heap = malloc(sizeof(looks_arf));
+    memcpy(heap, looks_arf, sizeof(looks_arf));
+    assert(arf_preload_host_path_len(heap, strlen(heap), buf, sizeof(buf)) ==
+           heap);
+    assert(arf_preload_host_path_len(heap, sizeof(looks_arf), buf,
+                                     sizeof(buf)) == heap);
+    free(heap);
+    static const char arf_len[] = UTF8_BOM "a" UTF8_REPLACEMENT "\0a\0\x7f";
+    assert(arf_preload_host_path_len(arf_len, sizeof(arf_len) - 1, buf,
+                                     sizeof(buf)) == buf);
+    assert(strcmp(buf, "a\xff") == 0);
+    assert(arf_preload_host_path_len(arf_len, sizeof(arf_len) - 2, buf,
+                                     sizeof(buf)) == arf_len);
+
+    // ARF strings are decoded.
+    const char *a = arf("foo\xff");
+    assert(arf_preload_host_path(a, buf, sizeof(buf)) == buf);
+    assert(strcmp(buf, "foo\xff") == 0);
+    a = arf("\xff" UTF8_REPLACEMENT "\xfe");
+    assert(arf_preload_host_path(a, buf, sizeof(buf)) == buf);
+    assert(strcmp(buf, "\xff" UTF8_REPLACEMENT "\xfe") == 0);
+    errno = 0;
+    assert(arf_preload_host_path(arf("foo\xff"), buf, 4) == NULL);
+    assert(errno == ENAMETOOLONG);
+
+    // This test is linked against libarf_preload.so, so calls into libc go
+    // through the shim.
+    char dir[] = "/tmp/arf_test_preload.XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    assert(chdir(dir) == 0);
+
+    // Unless the environment opts in, paths are passed on unchanged, so an
+    // ARF path names the file called by its BOM and lossy portion.
+    assert(unsetenv("ARF_PRELOAD_READ_PAST_NUL") == 0);
+    int lossy_fd = open(arf("l\xff"), O_CREAT | O_WRONLY, 0600);
+    assert(lossy_fd >= 0 && close(lossy_fd) == 0);
+    assert(has_entry(".", UTF8_BOM "l" UTF8_REPLACEMENT));
+    assert(unlink(UTF8_BOM "l" UTF8_REPLACEMENT) == 0);
+    assert(setenv("ARF_PRELOAD_READ_PAST_NUL", "1", 1) == 0);
+
+    int fd = open(arf("a\xff"), O_CREAT | O_WRONLY, 0600);
+    assert(fd >= 0);
+    assert(write(fd, "x", 1) == 1);
+    assert(close(fd) == 0);
+    assert(has_entry(".", "a\xff"));
+
+    struct stat st;
+    assert(stat(arf("a\xff"), &st) == 0 && st.st_size == 1);
+    assert(lstat(arf("a\xff"), &st) == 0);
+    assert(fstatat(AT_FDCWD, arf("a\xff"), &st, 0) == 0);
+    assert(access(arf("a\xff"), R_OK) == 0);
+    errno = 0;
+    assert(access(arf("a\xfe"), F_OK) == -1 && errno == ENOENT);
+
+    assert(rename(arf("a\xff"), arf("b\xfe")) == 0);
+    assert(!has_entry(".", "a\xff") && has_entry(".", "b\xfe"));
+    assert(symlink(arf("b\xfe"), arf("c\xfd")) == 0);
+    assert(readlink(arf("c\xfd"), buf, sizeof(buf)) == 2);
+    assert(memcmp(buf, "b\xfe", 2) == 0);
+    FILE *f = fopen(arf("c\xfd"), "r");
+    assert(f != NULL && fgetc(f) == 'x');
+    fclose(f);
+
+    assert(mkdir(arf("d\xfc"), 0700) == 0);
+    assert(has_entry(arf("d\xfc"), "."));
+    assert(rmdir(arf("d\xfc")) == 0);
+    assert(unlink(arf("c\xfd")) == 0);
+    assert(unlink(arf("b\xfe")) == 0);
+
+    // Paths whose decoded forms don't fit are rejected.
+    char *long_path = malloc(2 * PATH_MAX);
+    memset(long_path, 'x', PATH_MAX);
+    long_path[0] = '\xff';
+    long_path[PATH_MAX] = '\0';
+    size_t len = arf_encode((const uint8_t *)long_path, PATH_MAX, NULL, 0);
+    char *long_arf = malloc(len + 1);
+    arf_encode((const uint8_t *)long_path, PATH_MAX, (uint8_t *)long_arf, len);
+    errno = 0;
+    assert(open(long_arf, O_RDONLY) == -1 && errno == ENAMETOOLONG);
+    free(long_arf);
+    free(long_path);
+
+    assert(chdir("/") == 0);
+    assert(rmdir(dir) == 0);
+    return 0;
+}
@@ -0,0 +1,321 @@
+//! Convert lists of host paths between NUL-separated form, as written by
+//! `find -print0`, and UTF-8 manifests, using every core.
+//!
+//! Build with:
+//!
+//!     cc -O2 -pthread transcode.c arf.c -o arf-transcode
+//!
+//! and run as:
+//!
+//!     arf-transcode encode|decode INPUT OUTPUT [THREADS]
+//!
+//! A manifest has one UTF-8 record per line: the path itself if it's valid
+//! UTF-8, and its ARF string otherwise. Since ARF strings contain NUL, and
+//! paths may contain newlines, those bytes and backslash are written as `\0`,
+//! `\n`, and `\\`.
+//!
+//! The input is mapped and split into chunks at record boundaries. Threads
+//! claim chunks from a shared counter, so a thread which finishes its chunk
+//! early just takes the next one. A first pass works out how much output
+//! each chunk produces, so that the second pass can write every chunk straight
+//! to its place in the mapped output file.
+
+#define _GNU_SOURCE
+#include "arf.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The approximate amount of input in each chunk.
+static const size_t chunk_size = 1 << 20;
+
+struct chunk {
+    const uint8_t *begin;
+    const uint8_t *end;
+    size_t out_size;
+    size_t out_offset;
+};
+
+struct job {
+    bool decode;
+    struct chunk *chunks;
+    size_t count;
+    size_t next;
+    // The output mapping, or NULL during the sizing pass.
+    uint8_t *out;
+    // The first invalid record found, if any.
+    const uint8_t *invalid;
+};
+
+// A growable per-thread buffer for a single record.
+struct scratch {
+    uint8_t *buf;
+    size_t cap;
+};
+
+static void reserve(struct scratch *scratch, size_t size) {
+    if (size <= scratch->cap)
+        return;
+    scratch->buf = realloc(scratch->buf, size);
+    if (scratch->buf == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    scratch->cap = size;
+}
+
+// Convert the NUL-separated records in `chunk` into manifest lines. Write
+// them to `out` if it's non-NULL, and return their size either way.
+static size_t encode_chunk(const struct chunk *chunk, struct scratch *scratch,
+                           uint8_t *out) {
+    const uint8_t *ptr = chunk->begin;
+    size_t size = 0;
+
+    while (ptr != chunk->end) {
+        const uint8_t *nul = memchr(ptr, '\0', (size_t)(chunk->end - ptr));
+        const uint8_t *record_end = nul ? nul : chunk->end;
+        size_t len = (size_t)(record_end - ptr);
+
+        size_t utf8_len = arf_encode(ptr, len, scratch->buf, scratch->cap);
+        if (utf8_len > scratch->cap) {
+            reserve(scratch, utf8_len);
+            arf_encode(ptr, len, scratch->buf, scratch->cap);
+        }
+
+        for (size_t i = 0; i != utf8_len; ++i) {
+            uint8_t b = scratch->buf[i];
+            uint8_t escaped =
+                b == '\0' ? '0' : b == '\n' ? 'n' : b == '\\' ? '\\' : 0;
+            if (escaped != 0) {
+                if (out) {
+                    out[size] = '\\';
+                    out[size + 1] = escaped;
+                }
+                size += 2;
+            } else {
+                if (out)
+                    out[size] = b;
+                size += 1;
+            }
+        }
+        if (out)
+            out[size] = '\n';
+        size += 1;
+
+        ptr = nul ? nul + 1 : chunk->end;
+    }
+
+    return size;
+}
+
+// Convert the manifest lines in `chunk` into NUL-terminated records. Write
+// them to `out` if it's non-NULL, and return their size either way. On
+// invalid input, store the start of the offending line in *invalid and return
+// `SIZE_MAX`.
+static size_t decode_chunk(const struct chunk *chunk, struct scratch *scratch,
+                           uint8_t *out, const uint8_t **invalid) {
+    const uint8_t *ptr = chunk->begin;
+    size_t size = 0;
+
+    while (ptr != chunk->end) {
+        const uint8_t *newline = memchr(ptr, '\n', (size_t)(chunk->end - ptr));
+        const uint8_t *line_end = newline ? newline : chunk->end;
+
+        // Undo the manifest escapes.
+        reserve(scratch, (size_t)(line_end - ptr));
+        size_t len = 0;
+        for (const uint8_t *p = ptr; p != line_end; ++p) {
+            if (*p != '\\') {
+                scratch->buf[len++] = *p;
+                continue;
+            }
+            if (++p == line_end)
+                goto fail;
+            switch (*p) {
+            case '0': scratch->buf[len++] = '\0'; break;
+            case 'n': scratch->buf[len++] = '\n'; break;
+            case '\\': scratch->buf[len++] = '\\'; break;
+            default: goto fail;
+            }
+        }
+
+        size_t record_size;
+        enum arf_status status =
+            arf_decode(scratch->buf, len, out ? (char *)out + size : NULL,
+                       out ? chunk->out_size - size : 0, &record_size);
+        if (status == ARF_INVALID || (out && status != ARF_OK))
+            goto fail;
+        size += record_size;
+
+        ptr = newline ? newline + 1 : chunk->end;
+        continue;
+
+    fail:
+        *invalid = ptr;
+        return SIZE_MAX;
+    }
+
+    return size;
+}
+
+static void *worker(void *arg) {
+    struct job *job = arg;
+    struct scratch scratch = { NULL, 0 };
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count)
+            break;
+
+        struct chunk *chunk = &job->chunks[i];
+        uint8_t *out = job->out ? job->out + chunk->out_offset : NULL;
+        const uint8_t *invalid = NULL;
+        size_t size = job->decode
+                          ? decode_chunk(chunk, &scratch, out, &invalid)
+                          : encode_chunk(chunk, &scratch, out);
+
+        if (size == SIZE_MAX) {
+            // Report the earliest invalid record, whichever thread finds it.
+            const uint8_t *prev = NULL;
+            while (!__atomic_compare_exchange_n(&job->invalid, &prev, invalid,
+                                                false, __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+            {
+                if (prev < invalid)
+                    break;
+            }
+            size = 0;
+        }
+        if (!job->out)
+            chunk->out_size = size;
+    }
+
+    free(scratch.buf);
+    return NULL;
+}
+
+// Run `job` on `threads` threads, including this one.
+static void run(struct job *job, size_t threads) {
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (ids == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    job->next = 0;
+    for (size_t i = 1; i < threads; ++i) {
+        if (pthread_create(&ids[i], NULL, worker, job) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    worker(job);
+    for (size_t i = 1; i < threads; ++i)
+        pthread_join(ids[i], NULL);
+
+    free(ids);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s encode|decode INPUT OUTPUT [THREADS]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4 || argc > 5)
+        usage(argv[0]);
+
+    struct job job = { 0 };
+    if (strcmp(argv[1], "decode") == 0)
+        job.decode = true;
+    else if (strcmp(argv[1], "encode") != 0)
+        usage(argv[0]);
+
+    long threads = argc > 4 ? strtol(argv[4], NULL, 0)
+                            : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+
+    int in_fd = open(argv[2], O_RDONLY);
+    struct stat st;
+    if (in_fd < 0 || fstat(in_fd, &st) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    size_t in_len = (size_t)st.st_size;
+    const uint8_t *in = NULL;
+    if (in_len != 0) {
+        in = mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (in == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        madvise((void *)in, in_len, MADV_SEQUENTIAL);
+    }
+
+    // Split the input into chunks, each ending just after a terminator.
+    const uint8_t terminator = job.decode ? '\n' : '\0';
+    job.chunks = malloc((in_len / chunk_size + 1) * sizeof(struct chunk));
+    if (job.chunks == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (size_t pos = 0; pos != in_len;) {
+        size_t end = in_len - pos > chunk_size ? pos + chunk_size : in_len;
+        const uint8_t *t = memchr(in + end - 1, terminator, in_len - end + 1);
+        end = t ? (size_t)(t - in) + 1 : in_len;
+        job.chunks[job.count++] = (struct chunk){ in + pos, in + end, 0, 0 };
+        pos = end;
+    }
+
+    // Size each chunk's output, and lay the chunks out one after another.
+    run(&job, (size_t)threads);
+    if (job.invalid) {
+        fprintf(stderr, "%s: invalid record at offset %zu\n", argv[2],
+                (size_t)(job.invalid - in));
+        free(job.chunks);
+        return 1;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i != job.count; ++i) {
+        job.chunks[i].out_offset = total;
+        total += job.chunks[i].out_size;
+    }
+
+    int out_fd = open(argv[3], O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0 || ftruncate(out_fd, (off_t)total) != 0) {
+        perror(argv[3]);
+        return 1;
+    }
+    if (total != 0) {
+        job.out =
+            mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if (job.out == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+
+        run(&job, (size_t)threads);
+
+        if (munmap(job.out, total) != 0) {
+            perror("munmap");
+            return 1;
+        }
+    }
+
+    if (close(out_fd) != 0) {
+        perror(argv[3]);
+        return 1;
+    }
+
+    free(job.chunks);
+    if (in_len != 0)
+        munmap((void *)in, in_len);
+    close(in_fd);
+    return 0;
+}
@@ -1,12 +1,28 @@
+// Count a conversion event, if the `stats` feature is enabled.
+#[cfg(feature = "stats")]
+macro_rules! stat {
+    ($field:ident, $n:expr) => {
+        crate::stats::add(|c| &c.$field, $n as u64)
+    };
+}
+#[cfg(not(feature = "stats"))]
+macro_rules! stat {
+    ($field:ident, $n:expr) => {};
+}
+
 #[cfg(not(windows))]
 mod rustix;
+#[cfg(feature = "stats")]
+pub mod stats;
 #[cfg(windows)]
 mod windows;
 
 #[cfg(not(windows))]
 pub use crate::rustix::{
-    bytes_to_host, host_c_str_to_bytes, host_c_str_to_str, host_os_str_to_bytes,
-    host_os_str_to_str, str_to_host,
+    bytes_to_host, bytes_to_host_into, bytes_to_host_with, host_c_str_to_bytes,
+    host_c_str_to_bytes_into, host_c_str_to_str, host_c_str_to_str_into, host_os_str_to_bytes,
+    host_os_str_to_bytes_into, host_os_str_to_str, host_os_str_to_str_into, str_to_host,
+    str_to_host_into, str_to_host_with,
 };
 #[cfg(windows)]
 pub use windows::{bytes_to_host, host_to_bytes, host_to_str, str_to_host};
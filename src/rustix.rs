@@ -1,35 +1,175 @@
 use std::borrow::Cow;
 use std::ffi::{CStr, CString, OsStr};
+use std::mem::MaybeUninit;
 #[cfg(unix)]
 use std::os::unix::ffi::OsStrExt;
 #[cfg(target_os = "wasi")]
 use std::os::wasi::ffi::OsStrExt;
-use std::{io, str};
+use std::{io, ptr, str};
 
 /// Convert a byte sequence which is either plain UTF-8 or an ARF encoding into
 /// a `CString` ready for use in POSIX-style APIs.
 pub fn bytes_to_host(bytes: &[u8]) -> io::Result<CString> {
-    let s = str::from_utf8(bytes).map_err(|_| encoding_error())?;
+    let s = from_utf8(bytes)?;
     str_to_host(s)
 }
 
 /// Convert a `&str` which is either plain UTF-8 or an ARF encoding into a
 /// `CString` ready for use in POSIX-style APIs.
 pub fn str_to_host(s: &str) -> io::Result<CString> {
+    stat!(calls, 1);
     match CString::new(s) {
-        Ok(c_string) => Ok(c_string),
+        Ok(c_string) => {
+            stat!(fast_path, 1);
+            Ok(c_string)
+        }
         Err(e) => from_arf(s, e.nul_position()),
     }
 }
 
+/// Like `bytes_to_host`, but write the result into `buf`, replacing its
+/// contents, and return it as a `&CStr`. Reusing `buf` across calls avoids
+/// allocating once it has grown large enough.
+pub fn bytes_to_host_into<'a>(bytes: &[u8], buf: &'a mut Vec<u8>) -> io::Result<&'a CStr> {
+    let s = from_utf8(bytes)?;
+    str_to_host_into(s, buf)
+}
+
+/// Like `str_to_host`, but write the result into `buf`, replacing its
+/// contents, and return it as a `&CStr`. Reusing `buf` across calls avoids
+/// allocating once it has grown large enough.
+pub fn str_to_host_into<'a>(s: &str, buf: &'a mut Vec<u8>) -> io::Result<&'a CStr> {
+    stat!(calls, 1);
+    buf.clear();
+    match s.bytes().position(|b| b == b'\0') {
+        None => {
+            stat!(fast_path, 1);
+            buf.extend_from_slice(s.as_bytes())
+        }
+        Some(nul) => from_arf_into(s, nul, buf)?,
+    }
+    buf.push(b'\0');
+
+    // `buf` has exactly one NUL, at the end.
+    Ok(unsafe { CStr::from_bytes_with_nul_unchecked(buf) })
+}
+
+/// The longest host string, including its NUL terminator, that the `_with`
+/// functions build on the stack. This is the same limit that std uses for
+/// paths.
+const MAX_STACK_ALLOCATION: usize = 384;
+
+/// Like `bytes_to_host`, but pass the result to `f` instead of returning it.
+/// Strings of up to a few hundred bytes are converted in a buffer on the
+/// stack, so this doesn't allocate, which makes it suited to wrapping system
+/// calls.
+pub fn bytes_to_host_with<T>(
+    bytes: &[u8],
+    f: impl FnOnce(&CStr) -> io::Result<T>,
+) -> io::Result<T> {
+    let s = from_utf8(bytes)?;
+    str_to_host_with(s, f)
+}
+
+/// Like `str_to_host`, but pass the result to `f` instead of returning it.
+/// Strings of up to a few hundred bytes are converted in a buffer on the
+/// stack, so this doesn't allocate, which makes it suited to wrapping system
+/// calls.
+pub fn str_to_host_with<T>(s: &str, f: impl FnOnce(&CStr) -> io::Result<T>) -> io::Result<T> {
+    // The host string is never longer than `s`, so this leaves room for the
+    // NUL terminator.
+    if s.len() >= MAX_STACK_ALLOCATION {
+        return str_to_host_with_allocating(s, f);
+    }
+
+    stat!(calls, 1);
+    let mut buf = [MaybeUninit::<u8>::uninit(); MAX_STACK_ALLOCATION];
+    let mut out = StackBuf {
+        buf: &mut buf,
+        len: 0,
+    };
+    match s.bytes().position(|b| b == b'\0') {
+        None => {
+            stat!(fast_path, 1);
+            out.extend_from_slice(s.as_bytes())
+        }
+        Some(nul) => from_arf_into(s, nul, &mut out)?,
+    }
+    out.push(b'\0');
+    let len = out.len;
+
+    // The first `len` bytes are initialized, and have exactly one NUL, at the
+    // end.
+    let bytes = unsafe { std::slice::from_raw_parts(buf.as_ptr().cast::<u8>(), len) };
+    f(unsafe { CStr::from_bytes_with_nul_unchecked(bytes) })
+}
+
+/// Slow path for `str_to_host_with`, for strings too long for the stack.
+#[cold]
+fn str_to_host_with_allocating<T>(
+    s: &str,
+    f: impl FnOnce(&CStr) -> io::Result<T>,
+) -> io::Result<T> {
+    f(&str_to_host(s)?)
+}
+
+/// A destination for host bytes.
+trait HostBuf {
+    fn reserve(&mut self, additional: usize);
+    fn push(&mut self, b: u8);
+    fn extend_from_slice(&mut self, bytes: &[u8]);
+}
+
+impl HostBuf for Vec<u8> {
+    #[inline]
+    fn reserve(&mut self, additional: usize) {
+        Vec::reserve(self, additional)
+    }
+
+    #[inline]
+    fn push(&mut self, b: u8) {
+        Vec::push(self, b)
+    }
+
+    #[inline]
+    fn extend_from_slice(&mut self, bytes: &[u8]) {
+        Vec::extend_from_slice(self, bytes)
+    }
+}
+
+/// The stack buffer of `str_to_host_with`, of which the first `len` bytes
+/// are initialized.
+struct StackBuf<'a> {
+    buf: &'a mut [MaybeUninit<u8>],
+    len: usize,
+}
+
+impl HostBuf for StackBuf<'_> {
+    #[inline]
+    fn reserve(&mut self, _additional: usize) {}
+
+    #[inline]
+    fn push(&mut self, b: u8) {
+        self.buf[self.len].write(b);
+        self.len += 1;
+    }
+
+    #[inline]
+    fn extend_from_slice(&mut self, bytes: &[u8]) {
+        self.len = copy_to(self.buf, self.len, bytes);
+    }
+}
+
 /// Convert an `&OsStr` produced by POSIX-style APIs into a `Cow<str>` which
 /// is either plain UTF-8 or an ARF encoding. Returns an error if the input
 /// string contains NUL bytes.
 pub fn host_os_str_to_str(host: &OsStr) -> io::Result<Cow<str>> {
+    stat!(calls, 1);
     if host.as_bytes().contains(&b'\0') {
+        stat!(validation_failures, 1);
         return Err(encoding_error());
     }
-    Ok(if let Ok(s) = str::from_utf8(host.as_bytes()) {
+    Ok(if let Some(s) = host_bytes_as_str(host.as_bytes()) {
         Cow::Borrowed(s)
     } else {
         Cow::Owned(to_arf(host.as_bytes()))
@@ -46,10 +186,33 @@ pub fn host_os_str_to_bytes(host: &OsStr) -> io::Result<Cow<[u8]>> {
     })
 }
 
+/// Like `host_os_str_to_str`, but append the result to `out`.
+pub fn host_os_str_to_str_into(host: &OsStr, out: &mut String) -> io::Result<()> {
+    if host.as_bytes().contains(&b'\0') {
+        stat!(calls, 1);
+        stat!(validation_failures, 1);
+        return Err(encoding_error());
+    }
+    host_bytes_to_str_into(host.as_bytes(), out);
+    Ok(())
+}
+
+/// Like `host_os_str_to_bytes`, but append the result to `out`.
+pub fn host_os_str_to_bytes_into(host: &OsStr, out: &mut Vec<u8>) -> io::Result<()> {
+    if host.as_bytes().contains(&b'\0') {
+        stat!(calls, 1);
+        stat!(validation_failures, 1);
+        return Err(encoding_error());
+    }
+    host_bytes_to_bytes_into(host.as_bytes(), out);
+    Ok(())
+}
+
 /// Convert an `&CStr` produced by POSIX-style APIs into a `Cow<str>` which
 /// is either plain UTF-8 or an ARF encoding.
 pub fn host_c_str_to_str(host: &CStr) -> Cow<str> {
-    if let Ok(s) = str::from_utf8(host.to_bytes()) {
+    stat!(calls, 1);
+    if let Some(s) = host_bytes_as_str(host.to_bytes()) {
         Cow::Borrowed(s)
     } else {
         Cow::Owned(to_arf(host.to_bytes()))
@@ -66,108 +229,229 @@ pub fn host_c_str_to_bytes(host: &CStr) -> Cow<[u8]> {
     }
 }
 
+/// Like `host_c_str_to_str`, but append the result to `out`.
+pub fn host_c_str_to_str_into(host: &CStr, out: &mut String) {
+    host_bytes_to_str_into(host.to_bytes(), out)
+}
+
+/// Like `host_c_str_to_bytes`, but append the result to `out`.
+pub fn host_c_str_to_bytes_into(host: &CStr, out: &mut Vec<u8>) {
+    host_bytes_to_bytes_into(host.to_bytes(), out)
+}
+
+fn host_bytes_to_str_into(bytes: &[u8], out: &mut String) {
+    stat!(calls, 1);
+    if let Some(s) = host_bytes_as_str(bytes) {
+        out.push_str(s)
+    } else {
+        to_arf_into(bytes, out)
+    }
+}
+
+fn host_bytes_to_bytes_into(bytes: &[u8], out: &mut Vec<u8>) {
+    stat!(calls, 1);
+    if host_bytes_as_str(bytes).is_some() {
+        out.extend_from_slice(bytes)
+    } else {
+        encode_arf_into(bytes, out)
+    }
+}
+
+/// Validate `bytes` as the UTF-8 input of a conversion to host form.
+#[inline]
+fn from_utf8(bytes: &[u8]) -> io::Result<&str> {
+    stat!(bytes_scanned, bytes.len());
+    str::from_utf8(bytes).map_err(|_| {
+        stat!(calls, 1);
+        stat!(validation_failures, 1);
+        encoding_error()
+    })
+}
+
+/// Return `bytes` as a `&str` if it's valid UTF-8, which is the fast path of
+/// the conversions from host form.
+#[inline]
+fn host_bytes_as_str(bytes: &[u8]) -> Option<&str> {
+    stat!(bytes_scanned, bytes.len());
+    let s = str::from_utf8(bytes).ok();
+    if s.is_some() {
+        stat!(fast_path, 1);
+    }
+    s
+}
+
 /// Slow path for `str_to_host`.
 #[cold]
 fn from_arf(s: &str, nul: usize) -> io::Result<CString> {
+    // Leave room for the NUL terminator, so `CString` doesn't reallocate.
+    let mut vec = Vec::with_capacity(host_len_bound(s, nul) + 1);
+    from_arf_into(s, nul, &mut vec)?;
+
+    // Validation succeeded.
+    Ok(unsafe { CString::from_vec_unchecked(vec) })
+}
+
+/// Slow path for `str_to_host_into` and `str_to_host_with`, which appends the
+/// decoded bytes to `vec`.
+#[cold]
+fn from_arf_into(s: &str, nul: usize, vec: &mut impl HostBuf) -> io::Result<()> {
+    let result = decode_arf_into(s, nul, vec);
+    if result.is_ok() {
+        stat!(arf_decodes, 1);
+    } else {
+        stat!(validation_failures, 1);
+    }
+    result
+}
+
+/// The longest host string that the ARF string `s`, with its first NUL at
+/// `nul`, can decode to, which is the length of its NUL-escaped portion.
+fn host_len_bound(s: &str, nul: usize) -> usize {
+    s.len() - nul - 1
+}
+
+fn decode_arf_into(s: &str, nul: usize, vec: &mut impl HostBuf) -> io::Result<()> {
     if !s.starts_with('\u{feff}') {
         return Err(encoding_error());
     }
+    vec.reserve(host_len_bound(s, nul));
 
-    let mut lossy = s.bytes().skip('\u{feff}'.len_utf8());
-    let mut nul_escaped = s.bytes().skip(nul + 1);
+    // Both portions are the same runs of valid UTF-8, separated by U+FFFD in
+    // the lossy portion and by escapes in the NUL-escaped portion, so match
+    // them up a run at a time.
+    let mut lossy = &s.as_bytes()['\u{feff}'.len_utf8()..nul];
+    let mut nul_escaped = &s.as_bytes()[nul + 1..];
     let mut any_invalid = false;
-    let mut vec = Vec::new();
-    while let Some(b) = nul_escaped.next() {
-        if b == b'\0' {
-            let more = nul_escaped.next().ok_or_else(encoding_error)?;
-            if (more & 0x80) != 0 {
-                return Err(encoding_error());
-            }
-            // Test for U+FFFD.
-            let l0 = lossy.next().ok_or_else(encoding_error)?;
-            let l1 = lossy.next().ok_or_else(encoding_error)?;
-            let l2 = lossy.next().ok_or_else(encoding_error)?;
-            if [l0, l1, l2] != [0xef, 0xbf, 0xbd] {
-                return Err(encoding_error());
-            }
-            any_invalid = true;
-            vec.push(more | 0x80);
-        } else {
-            if lossy.next() != Some(b) {
+    loop {
+        let run = nul_escaped
+            .iter()
+            .position(|&b| b == b'\0')
+            .unwrap_or(nul_escaped.len());
+        if lossy.get(..run) != Some(&nul_escaped[..run]) {
+            return Err(encoding_error());
+        }
+        vec.extend_from_slice(&nul_escaped[..run]);
+        lossy = &lossy[run..];
+        nul_escaped = &nul_escaped[run..];
+
+        let [_, more, rest @ ..] = nul_escaped else {
+            // The end, unless there's a NUL with nothing after it.
+            if !nul_escaped.is_empty() {
                 return Err(encoding_error());
             }
-            vec.push(b);
+            break;
+        };
+        if (more & 0x80) != 0 {
+            return Err(encoding_error());
         }
+        // Test for U+FFFD.
+        let [0xef, 0xbf, 0xbd, lossy_rest @ ..] = lossy else {
+            return Err(encoding_error());
+        };
+        any_invalid = true;
+        vec.push(more | 0x80);
+        lossy = lossy_rest;
+        nul_escaped = rest;
     }
-    if !any_invalid {
-        return Err(encoding_error());
-    }
-    if lossy.next() != Some(b'\0') {
+    if !any_invalid || !lossy.is_empty() {
         return Err(encoding_error());
     }
 
-    // Validation succeeded.
-    Ok(unsafe { CString::from_vec_unchecked(vec) })
+    Ok(())
 }
 
 /// Slow path for `host_to_bytes`.
 #[cold]
 fn to_arf(bytes: &[u8]) -> String {
     let mut data = String::new();
+    to_arf_into(bytes, &mut data);
+    data
+}
 
-    data.push('\u{feff}');
+/// Slow path for the `_into` functions, which appends the ARF string to
+/// `data`.
+#[cold]
+fn to_arf_into(bytes: &[u8], data: &mut String) {
+    // The ARF string is valid UTF-8.
+    encode_arf_into(bytes, unsafe { data.as_mut_vec() })
+}
 
-    let mut input = bytes;
+/// The number of invalid bytes whose offsets `encode_arf_into` remembers
+/// between its scan and its copy. Strings with more are validated again
+/// from the last remembered one.
+const REMEMBERED_INVALID: usize = 32;
 
-    // This loop and `unsafe` follow the example in the documentation:
-    // <https://doc.rust-lang.org/std/str/struct.Utf8Error.html#examples>
-    loop {
-        match std::str::from_utf8(input) {
-            Ok(valid) => {
-                data.push_str(valid);
-                break;
-            }
-            Err(error) => {
-                let (valid, after_valid) = input.split_at(error.valid_up_to());
-                unsafe { data.push_str(str::from_utf8_unchecked(valid)) }
-                data.push('\u{FFFD}');
-
-                if let Some((_, remaining)) = after_valid.split_first() {
-                    input = remaining;
-                } else {
-                    break;
-                }
-            }
+/// Append the ARF encoding of `bytes` to `out`, without making it invalid
+/// UTF-8.
+fn encode_arf_into(bytes: &[u8], out: &mut Vec<u8>) {
+    stat!(arf_encodes, 1);
+
+    // Find the invalid bytes, which each become a three-byte U+FFFD in the
+    // lossy portion and a two-byte escape in the NUL-escaped portion, to
+    // size the result exactly.
+    let mut offsets = [0; REMEMBERED_INVALID];
+    let mut invalid = 0;
+    let mut pos = 0;
+    while let Some(at) = next_invalid(bytes, pos) {
+        if invalid < REMEMBERED_INVALID {
+            offsets[invalid] = at;
         }
+        invalid += 1;
+        pos = at + 1;
     }
+    stat!(invalid_bytes, invalid);
+    let bom = "\u{feff}".as_bytes();
+    let lossy_len = bom.len() + bytes.len() + 2 * invalid;
+    let len = lossy_len + 1 + bytes.len() + invalid;
 
-    data.push('\0');
+    // Fill in both portions in one pass over the runs between invalid bytes.
+    let start = out.len();
+    out.reserve(len);
+    let dst = &mut out.spare_capacity_mut()[..len];
+    let (lossy, nul_escaped) = dst.split_at_mut(lossy_len + 1);
+    let mut l = copy_to(lossy, 0, bom);
+    let mut e = 0;
+    let mut pos = 0;
+    for i in 0..invalid {
+        let at = match offsets.get(i) {
+            Some(&at) => at,
+            None => next_invalid(bytes, pos).unwrap(),
+        };
+        let run = &bytes[pos..at];
+        l = copy_to(lossy, l, run);
+        l = copy_to(lossy, l, "\u{fffd}".as_bytes());
+        e = copy_to(nul_escaped, e, run);
+        e = copy_to(nul_escaped, e, &[b'\0', bytes[at] & 0x7f]);
+        pos = at + 1;
+    }
+    let run = &bytes[pos..];
+    l = copy_to(lossy, l, run);
+    copy_to(lossy, l, b"\0");
+    copy_to(nul_escaped, e, run);
 
-    // This loop and `unsafe` follow the example in the documentation
-    // mentioned above.
-    let mut input = bytes;
-    loop {
-        match std::str::from_utf8(input) {
-            Ok(valid) => {
-                data.push_str(valid);
-                break;
-            }
-            Err(error) => {
-                let (valid, after_valid) = input.split_at(error.valid_up_to());
-
-                unsafe { data.push_str(str::from_utf8_unchecked(valid)) }
-                if let Some((byte, remaining)) = after_valid.split_first() {
-                    data.push('\0');
-                    data.push((byte & 0x7f) as char);
-                    input = remaining;
-                } else {
-                    break;
-                }
-            }
-        }
+    // Every byte of `dst` has been written.
+    unsafe { out.set_len(start + len) }
+}
+
+/// Return the offset of the first byte at or after `pos` in `bytes` which
+/// isn't part of valid UTF-8.
+#[inline]
+fn next_invalid(bytes: &[u8], pos: usize) -> Option<usize> {
+    match str::from_utf8(&bytes[pos..]) {
+        Ok(_) => None,
+        Err(error) => Some(pos + error.valid_up_to()),
     }
+}
 
-    data
+/// Copy `src` into `dst` at `at`, and return the offset just past it.
+#[inline]
+fn copy_to(dst: &mut [MaybeUninit<u8>], at: usize, src: &[u8]) -> usize {
+    let end = at + src.len();
+    let dst = &mut dst[at..end];
+    // `dst` has just been checked to be `src.len()` bytes long, and
+    // `MaybeUninit<u8>` has the same layout as `u8`.
+    unsafe { ptr::copy_nonoverlapping(src.as_ptr(), dst.as_mut_ptr().cast::<u8>(), src.len()) }
+    end
 }
 
 #[cold]
@@ -392,3 +676,136 @@ fn round_trip() {
         b"\xe6\x96"
     );
 }
+
+#[test]
+fn many_invalid_bytes() {
+    // More invalid bytes than `encode_arf_into` remembers offsets for.
+    let host: Vec<u8> = (0..100u8).flat_map(|i| [b'a' + i % 26, 0x80 | i]).collect();
+    let arf = host_os_str_to_str(OsStr::from_bytes(&host)).unwrap();
+    let mut expected = String::from("\u{feff}");
+    for i in 0..100u8 {
+        expected.push((b'a' + i % 26) as char);
+        expected.push('\u{fffd}');
+    }
+    expected.push('\0');
+    for i in 0..100u8 {
+        expected.push((b'a' + i % 26) as char);
+        expected.push('\0');
+        expected.push(i as char);
+    }
+    assert_eq!(arf, expected);
+    assert_eq!(str_to_host(&arf).unwrap().to_bytes(), host);
+}
+
+#[test]
+fn into_reuses_buffers() {
+    let mut buf = Vec::new();
+    assert_eq!(
+        str_to_host_into("foo", &mut buf).unwrap().to_bytes(),
+        b"foo"
+    );
+    assert_eq!(str_to_host_into("", &mut buf).unwrap().to_bytes(), b"");
+    assert_eq!(
+        str_to_host_into("\u{feff}hello\u{fffd}world\0hello\0\x05world", &mut buf)
+            .unwrap()
+            .to_bytes(),
+        b"hello\x85world"
+    );
+    assert_eq!(
+        bytes_to_host_into(b"hello", &mut buf).unwrap().to_bytes(),
+        b"hello"
+    );
+    assert!(str_to_host_into("\u{feff}hello\u{fffd}\0hello\0", &mut buf).is_err());
+    assert!(bytes_to_host_into(b"\xfe", &mut buf).is_err());
+
+    // Once the buffer is big enough, it isn't reallocated.
+    let ptr = buf.as_ptr();
+    let cap = buf.capacity();
+    assert_eq!(
+        str_to_host_into("bar", &mut buf).unwrap().to_bytes(),
+        b"bar"
+    );
+    assert_eq!(buf.as_ptr(), ptr);
+    assert_eq!(buf.capacity(), cap);
+
+    let mut s = String::from("prefix:");
+    host_os_str_to_str_into(OsStr::from_bytes(b"foo"), &mut s).unwrap();
+    host_os_str_to_str_into(OsStr::from_bytes(b"\xfe"), &mut s).unwrap();
+    host_c_str_to_str_into(CStr::from_bytes_with_nul(b"\xc0\xff\0").unwrap(), &mut s);
+    assert_eq!(
+        s,
+        "prefix:foo\u{feff}\u{fffd}\0\0\u{7e}\u{feff}\u{fffd}\u{fffd}\0\0\u{40}\0\u{7f}"
+    );
+    assert!(host_os_str_to_str_into(OsStr::from_bytes(b"a\0b"), &mut s).is_err());
+
+    let mut bytes = b"\xff".to_vec();
+    host_os_str_to_bytes_into(OsStr::from_bytes(b"foo"), &mut bytes).unwrap();
+    host_c_str_to_bytes_into(CStr::from_bytes_with_nul(b"\xfe\0").unwrap(), &mut bytes);
+    let mut expected = b"\xff".to_vec();
+    expected.extend_from_slice("foo\u{feff}\u{fffd}\0\0\u{7e}".as_bytes());
+    assert_eq!(bytes, expected);
+}
+
+#[test]
+fn with_closures() {
+    let plain = str_to_host_with("foo", |c| Ok(c.to_bytes().to_vec())).unwrap();
+    assert_eq!(plain, b"foo");
+    let empty = str_to_host_with("", |c| Ok(c.to_bytes().len())).unwrap();
+    assert_eq!(empty, 0);
+    let arf = str_to_host_with("\u{feff}hello\u{fffd}world\0hello\0\x05world", |c| {
+        Ok(c.to_bytes().to_vec())
+    })
+    .unwrap();
+    assert_eq!(arf, b"hello\x85world");
+    let bytes = bytes_to_host_with(b"hello", |c| Ok(c.to_bytes().to_vec())).unwrap();
+    assert_eq!(bytes, b"hello");
+
+    // Invalid input doesn't reach the closure.
+    assert!(
+        str_to_host_with("\u{feff}hello\u{fffd}\0hello\0", |_| -> io::Result<()> {
+            unreachable!()
+        })
+        .is_err()
+    );
+    assert!(bytes_to_host_with(b"\xfe", |_| -> io::Result<()> { unreachable!() }).is_err());
+
+    // The closure's errors are passed through.
+    let err = str_to_host_with("foo", |_| -> io::Result<()> {
+        Err(io::ErrorKind::NotFound.into())
+    })
+    .unwrap_err();
+    assert_eq!(err.kind(), io::ErrorKind::NotFound);
+
+    // Strings on either side of the stack buffer's size, plain and ARF.
+    for len in [MAX_STACK_ALLOCATION - 2, MAX_STACK_ALLOCATION + 2] {
+        let plain = "a".repeat(len);
+        let host = str_to_host_with(&plain, |c| Ok(c.to_bytes().to_vec())).unwrap();
+        assert_eq!(host, plain.as_bytes());
+
+        let mut invalid = vec![b'a'; len / 2];
+        invalid.push(0xff);
+        let arf = host_os_str_to_str(OsStr::from_bytes(&invalid)).unwrap();
+        let host = str_to_host_with(&arf, |c| Ok(c.to_bytes().to_vec())).unwrap();
+        assert_eq!(host, invalid);
+    }
+}
+
+#[cfg(feature = "stats")]
+#[test]
+fn stats() {
+    // Other tests run concurrently, so only check that our counts are
+    // included.
+    let before = crate::stats::get();
+    assert_eq!(host_c_str_to_str(c"foo"), "foo");
+    let arf = host_c_str_to_str(c"a\xff\xfe").into_owned();
+    assert_eq!(str_to_host(&arf).unwrap().as_bytes(), b"a\xff\xfe");
+    assert!(bytes_to_host(b"\xff").is_err());
+    let after = crate::stats::get();
+    assert!(after.calls >= before.calls + 4);
+    assert!(after.fast_path >= before.fast_path + 1);
+    assert!(after.bytes_scanned >= before.bytes_scanned + 3 + 3 + 1);
+    assert!(after.invalid_bytes >= before.invalid_bytes + 2);
+    assert!(after.arf_encodes >= before.arf_encodes + 1);
+    assert!(after.arf_decodes >= before.arf_decodes + 1);
+    assert!(after.validation_failures >= before.validation_failures + 1);
+}
@@ -0,0 +1,145 @@
+//! Counters of conversions, for telling how often the fast paths are taken
+//! and how much work the slow paths do. Enabled by the `stats` feature;
+//! without it, this module doesn't exist and the counting compiles away.
+//!
+//! Each thread counts into its own counters, and `get` adds them all up, so
+//! counting doesn't contend between threads.
+
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard};
+
+macro_rules! stats {
+    ($($(#[$doc:meta])* $field:ident,)*) => {
+        /// Conversion counts, summed over all threads.
+        #[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+        pub struct Stats {
+            $($(#[$doc])* pub $field: u64,)*
+        }
+
+        impl Stats {
+            const ZERO: Self = Self { $($field: 0,)* };
+
+            fn add(&mut self, counters: &Counters) {
+                $(self.$field += counters.$field.load(Ordering::Relaxed);)*
+            }
+
+            fn sub(&self, other: &Self) -> Self {
+                Self { $($field: self.$field - other.$field,)* }
+            }
+        }
+
+        /// A thread's counters. Only the owning thread writes to them.
+        #[derive(Default)]
+        pub(crate) struct Counters {
+            $(pub(crate) $field: AtomicU64,)*
+        }
+    };
+}
+
+stats! {
+    /// Calls to conversion functions.
+    calls,
+    /// Strings which were plain UTF-8, and so took the fast path.
+    fast_path,
+    /// Bytes checked by UTF-8 validation.
+    bytes_scanned,
+    /// Invalid bytes escaped by ARF encoding.
+    invalid_bytes,
+    /// Strings encoded as ARF strings.
+    arf_encodes,
+    /// ARF strings decoded.
+    arf_decodes,
+    /// Inputs rejected as invalid.
+    validation_failures,
+}
+
+struct Registry {
+    /// The counters of running threads.
+    live: Vec<Arc<Counters>>,
+    /// The totals of threads which have exited.
+    retired: Stats,
+    /// The totals as of the last `reset`.
+    baseline: Stats,
+}
+
+static REGISTRY: Mutex<Registry> = Mutex::new(Registry {
+    live: Vec::new(),
+    retired: Stats::ZERO,
+    baseline: Stats::ZERO,
+});
+
+fn registry() -> MutexGuard<'static, Registry> {
+    // The registry is consistent between statements, so a panic elsewhere
+    // doesn't leave it broken.
+    REGISTRY.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+/// A thread's registration, which folds its counters into the retired
+/// totals when the thread exits.
+struct Local(Arc<Counters>);
+
+impl Local {
+    fn new() -> Self {
+        let counters = Arc::new(Counters::default());
+        registry().live.push(Arc::clone(&counters));
+        Self(counters)
+    }
+}
+
+impl Drop for Local {
+    fn drop(&mut self) {
+        let mut registry = registry();
+        registry.retired.add(&self.0);
+        registry.live.retain(|c| !Arc::ptr_eq(c, &self.0));
+    }
+}
+
+thread_local! {
+    static LOCAL: Local = Local::new();
+}
+
+/// Add `n` to the current thread's counter selected by `field`. Counts made
+/// while the thread is exiting are dropped.
+#[inline]
+pub(crate) fn add(field: impl FnOnce(&Counters) -> &AtomicU64, n: u64) {
+    let _ = LOCAL.try_with(|local| {
+        let counter = field(&local.0);
+        counter.store(counter.load(Ordering::Relaxed) + n, Ordering::Relaxed);
+    });
+}
+
+fn total(registry: &Registry) -> Stats {
+    let mut total = registry.retired;
+    for counters in &registry.live {
+        total.add(counters);
+    }
+    total
+}
+
+/// Return the totals of every thread's counters since the last `reset`.
+pub fn get() -> Stats {
+    let registry = registry();
+    total(&registry).sub(&registry.baseline)
+}
+
+/// Start counting again from zero.
+pub fn reset() {
+    let mut registry = registry();
+    registry.baseline = total(&registry);
+}
+
+#[test]
+fn counts() {
+    // Other tests run concurrently, so count on a thread of our own, and only
+    // check that its counts are included.
+    let before = get();
+    std::thread::spawn(|| {
+        add(|c| &c.calls, 2);
+        add(|c| &c.invalid_bytes, 3);
+    })
+    .join()
+    .unwrap();
+    let after = get();
+    assert!(after.calls >= before.calls + 2);
+    assert!(after.invalid_bytes >= before.invalid_bytes + 3);
+}
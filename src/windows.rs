@@ -6,16 +6,29 @@ use std::{io, str};
 /// Convert a byte sequence which is either plain UTF-8 or an ARF encoding into
 /// a `OsString` ready for use in Windows-style APIs.
 pub fn bytes_to_host(bytes: &[u8]) -> io::Result<OsString> {
-    let s = str::from_utf8(bytes).map_err(|_| encoding_error())?;
+    stat!(bytes_scanned, bytes.len());
+    let s = str::from_utf8(bytes).map_err(|_| {
+        stat!(calls, 1);
+        stat!(validation_failures, 1);
+        encoding_error()
+    })?;
     str_to_host(s)
 }
 
 /// Convert a `&str` which is either plain UTF-8 or an ARF encoding into a
 /// `OsString` ready for use in Windows-style APIs.
 pub fn str_to_host(s: &str) -> io::Result<OsString> {
+    stat!(calls, 1);
     if let Some(nul_position) = s.chars().position(|c| c == '\0') {
-        from_arf(s, nul_position)
+        let result = from_arf(s, nul_position);
+        if result.is_ok() {
+            stat!(arf_decodes, 1);
+        } else {
+            stat!(validation_failures, 1);
+        }
+        result
     } else {
+        stat!(fast_path, 1);
         Ok(OsString::from_wide(&s.encode_utf16().collect::<Vec<_>>()))
     }
 }
@@ -23,11 +36,15 @@ pub fn str_to_host(s: &str) -> io::Result<OsString> {
 /// Convert an `&OsStr` produced by Windows-style APIs into a `Cow<str>` which
 /// is either plain UTF-8 or an ARF encoding.
 pub fn host_to_str(host: &OsStr) -> io::Result<String> {
+    stat!(calls, 1);
     let wide = host.encode_wide().collect::<Vec<_>>();
     if wide.contains(&0) {
+        stat!(validation_failures, 1);
         return Err(encoding_error());
     }
+    stat!(bytes_scanned, wide.len() * 2);
     Ok(if let Ok(s) = String::from_utf16(&wide) {
+        stat!(fast_path, 1);
         s
     } else {
         to_arf(&wide)
@@ -90,6 +107,7 @@ fn from_arf(s: &str, nul: usize) -> io::Result<OsString> {
 /// Slow path for `host_to_bytes`.
 #[cold]
 fn to_arf(units: &[u16]) -> String {
+    stat!(arf_encodes, 1);
     let mut data = String::new();
 
     data.push('\u{feff}');
@@ -97,7 +115,10 @@ fn to_arf(units: &[u16]) -> String {
     for unit in decode_utf16(units.iter().copied()) {
         match unit {
             Ok(c) => data.push(c),
-            Err(_) => data.push('\u{fffd}'),
+            Err(_) => {
+                stat!(invalid_bytes, 1);
+                data.push('\u{fffd}')
+            }
         }
     }
 